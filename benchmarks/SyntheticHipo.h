@@ -0,0 +1,294 @@
+#pragma once
+
+//!  Write synthetic CLAS12 hipo files for benchmarks
+
+/*!
+  Events are e p -> e' p' pi+ pi- with some additional
+  random particles. MC::Lund holds the generated particles,
+  REC::Particle the smeared particles in a shuffled order
+  and MC::GenMatch the map between them.
+  A fraction of events have the electron in the Forward Tagger;
+  RECFT::Particle then has the pids, while REC::Particle has no
+  start time for the hadrons (pid 0). Detector banks
+  REC::Scintillator, REC::Calorimeter, REC::ForwardTagger and
+  REC::Traj have hits for the particles in their acceptance.
+  Bank layouts follow the CLAS12 banks for the items used here,
+  the values are only roughly realistic.
+*/
+#include "hipo4/writer.h"
+#include <TRandom3.h>
+#include <TMath.h>
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <random>
+#include <map>
+#include "clas12defs.h"
+
+namespace rad{
+  namespace clas12 {
+    namespace synthetic {
+
+      struct particle_t {
+	int pid;
+	float px,py,pz,vz;
+	short charge;
+	float mass;
+      };
+
+      /**
+       * Event content, nextra = mean number of additional random particles
+       */
+      struct config_t {
+	double nextra = 2;
+	double ft_fraction = 0.1; //events with the electron in the FT
+	bool detectors = true; //write detector banks
+	UInt_t seed = 1234;
+      };
+
+      /**
+       * Make a particle with momentum magnitude and theta in the given ranges
+       */
+      inline particle_t MakeParticle(TRandom3& rand,int pid,short charge,float mass,double pmin,double pmax,double thmin,double thmax){
+	auto p = rand.Uniform(pmin,pmax);
+	auto th = rand.Uniform(thmin,thmax)*TMath::DegToRad();
+	auto ph = rand.Uniform(-TMath::Pi(),TMath::Pi());
+	return particle_t{pid,
+	    static_cast<float>(p*TMath::Sin(th)*TMath::Cos(ph)),
+	    static_cast<float>(p*TMath::Sin(th)*TMath::Sin(ph)),
+	    static_cast<float>(p*TMath::Cos(th)),
+	    static_cast<float>(rand.Gaus(-3,2)),
+	    charge,mass};
+      }
+      inline double Theta(const particle_t& p){return TMath::ATan2(TMath::Sqrt(p.px*p.px+p.py*p.py),p.pz)*TMath::RadToDeg();}
+      inline double PMag(const particle_t& p){return TMath::Sqrt(p.px*p.px+p.py*p.py+p.pz*p.pz);}
+      inline double Beta(const particle_t& p){auto pm=PMag(p); return pm/TMath::Sqrt(pm*pm+p.mass*p.mass);}
+      inline short Region(const particle_t& p){auto th=Theta(p); return th<5 ? 1 : (th<35 ? 2 : 4);}//FT,FD,CD
+      inline short Sector(const particle_t& p){
+	auto ph = TMath::ATan2(p.py,p.px)*TMath::RadToDeg()+30;
+	if(ph<0) ph+=360;
+	return static_cast<short>(ph/60)%6+1;
+      }
+
+      /**
+       * Count rows then fill, hipo banks are made with their size
+       */
+      struct hit_t {
+	short pindex;
+	short detector;
+	short layer;
+	float energy,time,path;
+	float x,y,z,edge;
+	short sector;
+      };
+      
+      inline void WriteSyntheticHipo(const string& filename,Long64_t nevents,const config_t& config){
+	hipo::schema run_schema("RUN::config",10000,11);
+	run_schema.parse("run/I,event/I,unixtime/I,trigger/L,timestamp/L,type/B,mode/B,torus/F,solenoid/F");
+	hipo::schema rec_schema("REC::Particle",300,31);
+	rec_schema.parse("pid/I,px/F,py/F,pz/F,vx/F,vy/F,vz/F,vt/F,charge/B,beta/F,chi2pid/F,status/S");
+	hipo::schema ft_schema("RECFT::Particle",300,40);
+	ft_schema.parse("pid/I,px/F,py/F,pz/F,vt/F,charge/B,beta/F,chi2pid/F,status/S");
+	hipo::schema lund_schema("MC::Lund",40,3);
+	lund_schema.parse("index/B,lifetime/F,type/B,pid/I,parent/B,daughter/B,px/F,py/F,pz/F,energy/F,mass/F,vx/F,vy/F,vz/F");
+	hipo::schema match_schema("MC::GenMatch",40,6);
+	match_schema.parse("pindex/S,mcindex/S,quality/F");
+	hipo::schema sc_schema("REC::Scintillator",300,35);
+	sc_schema.parse("index/S,pindex/S,detector/B,sector/B,layer/B,component/S,energy/F,time/F,path/F,chi2/F,x/F,y/F,z/F,status/S");
+	hipo::schema cal_schema("REC::Calorimeter",300,32);
+	cal_schema.parse("index/S,pindex/S,detector/B,sector/B,layer/B,energy/F,time/F,path/F,chi2/F,x/F,y/F,z/F,status/S");
+	hipo::schema ftag_schema("REC::ForwardTagger",300,38);
+	ftag_schema.parse("index/S,pindex/S,detector/B,energy/F,time/F,path/F,chi2/F,x/F,y/F,z/F,radius/F,size/S,status/S");
+	hipo::schema traj_schema("REC::Traj",300,37);
+	traj_schema.parse("pindex/S,index/S,detector/B,layer/B,x/F,y/F,z/F,cx/F,cy/F,cz/F,path/F,edge/F");
+
+	hipo::writer writer;
+	for(auto* schema:{&run_schema,&rec_schema,&ft_schema,&lund_schema,&match_schema,&sc_schema,&cal_schema,&ftag_schema,&traj_schema})
+	  writer.getDictionary().addSchema(*schema);
+	writer.open(filename.data());
+
+	TRandom3 rand(config.seed);
+	hipo::event event;
+	std::vector<particle_t> parts;
+	std::vector<short> order;
+	std::vector<hit_t> sc_hits,cal_hits,ft_hits,traj_hits;
+	const double c = 29.9792458; //cm/ns
+	
+	for(Long64_t iev=0;iev<nevents;++iev){
+	  const bool ftEvent = rand.Uniform()<config.ft_fraction;
+	  parts.clear();
+	  if(ftEvent) parts.push_back(MakeParticle(rand,11,-1,0.000511,0.5,4.5,2.5,4.5));
+	  else parts.push_back(MakeParticle(rand,11,-1,0.000511,1.5,8,6,30));
+	  parts.push_back(MakeParticle(rand,2212,1,0.938272,0.3,2,10,60));
+	  parts.push_back(MakeParticle(rand,211,1,0.139570,0.4,4,5,40));
+	  parts.push_back(MakeParticle(rand,-211,-1,0.139570,0.4,4,5,40));
+	  auto nx = rand.Poisson(config.nextra);
+	  for(UInt_t ix=0;ix<nx;++ix){
+	    if(rand.Uniform()<0.5) parts.push_back(MakeParticle(rand,22,0,0,0.1,2,5,35));
+	    else{
+	      const int pid = rand.Uniform()<0.5 ? 211 : -211;
+	      parts.push_back(MakeParticle(rand,pid,pid>0?1:-1,0.139570,0.2,3,5,120));
+	    }
+	  }
+	  const int npart = parts.size();
+	  
+	  //REC::Particle in shuffled order
+	  order.resize(npart);
+	  std::iota(order.begin(),order.end(),0);
+	  std::shuffle(order.begin()+1,order.end(),std::mt19937(config.seed+iev));//electron stays first like EB
+
+	  hipo::bank run_bank(run_schema,1);
+	  run_bank.putInt("run",0,5000+iev/1000000);
+	  run_bank.putInt("event",0,static_cast<int>(iev+1));
+	  run_bank.putLong("trigger",0,ftEvent ? 0x2 : 0x1);
+	  run_bank.putFloat("torus",0,-1);
+	  run_bank.putFloat("solenoid",0,-1);
+	  
+	  hipo::bank lund_bank(lund_schema,npart);
+	  hipo::bank rec_bank(rec_schema,npart);
+	  hipo::bank ft_bank(ft_schema,npart);
+	  hipo::bank match_bank(match_schema,npart);
+	  sc_hits.clear(); cal_hits.clear(); ft_hits.clear(); traj_hits.clear();
+	  for(int i=0;i<npart;++i){
+	    const auto& mc = parts[i];
+	    lund_bank.putByte("index",i,i+1);
+	    lund_bank.putByte("type",i,1);
+	    lund_bank.putInt("pid",i,mc.pid);
+	    lund_bank.putFloat("px",i,mc.px);
+	    lund_bank.putFloat("py",i,mc.py);
+	    lund_bank.putFloat("pz",i,mc.pz);
+	    lund_bank.putFloat("mass",i,mc.mass);
+	    lund_bank.putFloat("energy",i,TMath::Sqrt(mc.px*mc.px+mc.py*mc.py+mc.pz*mc.pz+mc.mass*mc.mass));
+	    lund_bank.putFloat("vz",i,mc.vz);
+
+	    //reconstructed with 1% momentum resolution
+	    const short irec = order[i];
+	    const auto res = rand.Gaus(1,0.01);
+	    const auto region = Region(mc);
+	    const short status = (irec==0 ? -1 : 1)*(1000*region+10);
+	    const auto beta = rand.Gaus(Beta(mc),0.01);
+	    //without the FT start time hadrons have no EB pid
+	    const int recpid = (ftEvent && irec!=0) ? 0 : mc.pid;
+	    rec_bank.putInt("pid",irec,recpid);
+	    rec_bank.putFloat("px",irec,mc.px*res);
+	    rec_bank.putFloat("py",irec,mc.py*res);
+	    rec_bank.putFloat("pz",irec,mc.pz*res);
+	    rec_bank.putFloat("vz",irec,rand.Gaus(mc.vz,0.5));
+	    rec_bank.putByte("charge",irec,mc.charge);
+	    rec_bank.putFloat("beta",irec,beta);
+	    rec_bank.putFloat("chi2pid",irec,rand.Gaus(0,1));
+	    rec_bank.putShort("status",irec,status);
+	    
+	    //FT based, only has pids if there is an FT electron
+	    ft_bank.putInt("pid",irec,ftEvent ? mc.pid : 0);
+	    ft_bank.putFloat("px",irec,mc.px*res);
+	    ft_bank.putFloat("py",irec,mc.py*res);
+	    ft_bank.putFloat("pz",irec,mc.pz*res);
+	    ft_bank.putByte("charge",irec,mc.charge);
+	    ft_bank.putFloat("beta",irec,beta);
+	    ft_bank.putFloat("chi2pid",irec,rand.Gaus(0,1));
+	    ft_bank.putShort("status",irec,status);
+
+	    match_bank.putShort("pindex",i,irec);
+	    match_bank.putShort("mcindex",i,i);
+	    match_bank.putFloat("quality",i,1);
+
+	    if(config.detectors==false) continue;
+	    //detector hits, time = path / (beta c)
+	    const auto pmag = PMag(mc);
+	    const auto sector = Sector(mc);
+	    auto hit = [&](short det,short layer,float energy,float path,float edge){
+	      return hit_t{irec,det,layer,energy,static_cast<float>(path/(Beta(mc)*c)+rand.Gaus(0,0.1)),path,
+		  static_cast<float>(path*mc.px/pmag),static_cast<float>(path*mc.py/pmag),static_cast<float>(path*mc.pz/pmag),edge,sector};
+	    };
+	    if(region==1){
+	      if(mc.charge!=0) ft_hits.push_back(hit(FTHODO,1,0.002,185,0));
+	      ft_hits.push_back(hit(FTCAL,1,static_cast<float>(rand.Gaus(pmag,0.02*pmag)),190,0));
+	    }
+	    else if(region==2){
+	      if(mc.charge!=0){
+		for(auto layer:{DC1,DC3,DC6}) traj_hits.push_back(hit(DC,layer,0,230+40*layer/6.,static_cast<float>(rand.Uniform(0,30))));
+		sc_hits.push_back(hit(FTOF,FTOF1B,static_cast<float>(rand.Gaus(10,2)),650,0));
+		if(rand.Uniform()<0.8) sc_hits.push_back(hit(FTOF,FTOF1A,static_cast<float>(rand.Gaus(8,2)),645,0));
+	      }
+	      //electrons and photons shower, hadrons deposit little
+	      const bool shower = mc.pid==11 || mc.pid==22;
+	      cal_hits.push_back(hit(ECAL,PCAL,static_cast<float>(shower ? 0.12*pmag : 0.02),720,0));
+	      cal_hits.push_back(hit(ECAL,ECIN,static_cast<float>(shower ? 0.09*pmag : 0.03),740,0));
+	      if(shower || rand.Uniform()<0.5) cal_hits.push_back(hit(ECAL,ECOUT,static_cast<float>(shower ? 0.04*pmag : 0.04),760,0));
+	    }
+	    else if(mc.charge!=0){
+	      sc_hits.push_back(hit(CTOF,1,static_cast<float>(rand.Gaus(5,1)),35,0));
+	    }
+	  }
+
+	  event.reset();
+	  event.addStructure(run_bank);
+	  event.addStructure(rec_bank);
+	  event.addStructure(ft_bank);
+	  event.addStructure(lund_bank);
+	  event.addStructure(match_bank);
+	  if(config.detectors){
+	    //banks of hits, items not set are 0
+	    auto fill = [](hipo::schema& schema,const std::vector<hit_t>& hits,bool hasLayer,bool hasSector){
+	      hipo::bank bank(schema,hits.size());
+	      for(size_t ih=0;ih<hits.size();++ih){
+		const auto& h = hits[ih];
+		bank.putShort("pindex",ih,h.pindex);
+		bank.putByte("detector",ih,h.detector);
+		if(hasLayer) bank.putByte("layer",ih,h.layer);
+		if(hasSector) bank.putByte("sector",ih,h.sector);
+		bank.putFloat("x",ih,h.x);
+		bank.putFloat("y",ih,h.y);
+		bank.putFloat("z",ih,h.z);
+		bank.putFloat("path",ih,h.path);
+	      }
+	      return bank;
+	    };
+	    auto sc_bank = fill(sc_schema,sc_hits,true,true);
+	    auto cal_bank = fill(cal_schema,cal_hits,true,true);
+	    auto ftag_bank = fill(ftag_schema,ft_hits,false,false);
+	    auto traj_bank = fill(traj_schema,traj_hits,true,false);
+	    for(size_t ih=0;ih<sc_hits.size();++ih){
+	      sc_bank.putShort("index",ih,ih);
+	      sc_bank.putFloat("energy",ih,sc_hits[ih].energy);
+	      sc_bank.putFloat("time",ih,sc_hits[ih].time);
+	    }
+	    for(size_t ih=0;ih<cal_hits.size();++ih){
+	      cal_bank.putShort("index",ih,ih);
+	      cal_bank.putFloat("energy",ih,cal_hits[ih].energy);
+	      cal_bank.putFloat("time",ih,cal_hits[ih].time);
+	    }
+	    for(size_t ih=0;ih<ft_hits.size();++ih){
+	      ftag_bank.putShort("index",ih,ih);
+	      ftag_bank.putFloat("energy",ih,ft_hits[ih].energy);
+	      ftag_bank.putFloat("time",ih,ft_hits[ih].time);
+	    }
+	    for(size_t ih=0;ih<traj_hits.size();++ih){
+	      traj_bank.putShort("index",ih,ih);
+	      traj_bank.putFloat("edge",ih,traj_hits[ih].edge);
+	    }
+	    event.addStructure(sc_bank);
+	    event.addStructure(cal_bank);
+	    event.addStructure(ftag_bank);
+	    event.addStructure(traj_bank);
+	  }
+	  writer.addEvent(event);
+	}
+	writer.close();
+	std::cout<<"WriteSyntheticHipo wrote "<<nevents<<" events to "<<filename<<std::endl;
+      }
+      /**
+       * Write nevents to filename
+       * nextra = mean number of additional random particles per event
+       */
+      inline void WriteSyntheticHipo(const string& filename,Long64_t nevents,double nextra=2,UInt_t seed=1234){
+	config_t config;
+	config.nextra = nextra;
+	config.seed = seed;
+	WriteSyntheticHipo(filename,nevents,config);
+      }
+
+    }//synthetic
+  }//clas12
+}//rad
@@ -0,0 +1,373 @@
+#pragma once
+
+//!  Combinatorial analysis of CLAS12 final states
+
+/*!
+  Instead of choosing one REC::Particle row per final state particle
+  (e.g. useNthOccurance) make every valid assignment of rows to the
+  named particles in each event. Kinematics can be calculated for all
+  combinations at once, giving arrays with one entry per combination,
+  and the best combination can be used to set the particle indices
+  for the rest of the analysis.
+  With PidHypotheses a track is a candidate for every role its
+  delta beta allows, and the role masses are used, rather than
+  the EB pid and mass.
+*/
+#include "CLAS12Reaction.h"
+#include "CLAS12EventArena.h"
+#include "CLAS12PidHypotheses.h"
+#include <ROOT/RVec.hxx>
+#include <cmath>
+#include <array>
+#include <algorithm>
+#include <stdexcept>
+
+namespace rad{
+  namespace clas12 {
+
+    /**
+     * Combinations of one event, memory owned by the EventArena
+     * rows[icombo*nroles + irole] = REC::Particle row for role
+     */
+    struct combos_t{
+      const short* rows = nullptr;
+      size_t ncombos = 0;
+      size_t nroles = 0;
+
+      short Row(size_t icombo,size_t irole) const {return rows[icombo*nroles+irole];}
+    };
+
+    /**
+     * Fill all assignments of particles to roles.
+     * Particles are first bucketed by role, accept(irole,row), so each
+     * role only loops over its own candidates, a row is never used
+     * twice in one combination. At most max_combos are made.
+     */
+    template<typename Accept>
+    combos_t MakeCombinations(size_t npart, size_t nroles, Accept&& accept, size_t max_combos, EventArena& arena, unsigned int slot, ULong64_t entry){
+      combos_t result;
+      result.nroles = nroles;
+      if(nroles==0 || npart==0) return result;
+
+      //bucket rows by role, role r has nbucket[r] rows in buckets[r*npart ...]
+      auto buckets = arena.Allocate<short>(slot,entry,nroles*npart);
+      auto nbucket = arena.Allocate<size_t>(slot,entry,nroles);
+      size_t nbound = 1;
+      for(size_t ir=0;ir<nroles;++ir){
+	nbucket[ir] = 0;
+	for(size_t ip=0;ip<npart;++ip){
+	  if(accept(ir,ip)) buckets[ir*npart + nbucket[ir]++] = ip;
+	}
+	if(nbucket[ir]==0) return result;
+	nbound = std::min(nbound*nbucket[ir],max_combos);
+      }
+
+      auto rows = arena.Allocate<short>(slot,entry,nbound*nroles);
+      auto counter = arena.Allocate<size_t>(slot,entry,nroles);
+      std::fill(counter,counter+nroles,0);
+
+      size_t ncombos = 0;
+      while(ncombos<nbound){
+	//check this assignment does not reuse a row
+	auto combo = rows + ncombos*nroles;
+	bool valid = true;
+	for(size_t ir=0;ir<nroles && valid;++ir){
+	  combo[ir] = buckets[ir*npart + counter[ir]];
+	  for(size_t jr=0;jr<ir;++jr) valid &= (combo[jr]!=combo[ir]);
+	}
+	if(valid) ++ncombos;
+	//next assignment
+	size_t ir=0;
+	for(;ir<nroles;++ir){
+	  if(++counter[ir]<nbucket[ir]) break;
+	  counter[ir]=0;
+	}
+	if(ir==nroles) break;//done all
+      }
+      result.rows = rows;
+      result.ncombos = ncombos;
+      return result;
+    }
+    /**
+     * Roles are filled by rows with their pid
+     */
+    inline combos_t MakeCombinations(const ROOT::RVecI& pid, const ROOT::RVecI& role_pids, size_t max_combos, EventArena& arena, unsigned int slot, ULong64_t entry){
+      return MakeCombinations(pid.size(),role_pids.size(),[&](size_t ir,size_t ip){return pid[ip]==role_pids[ir];},max_combos,arena,slot,entry);
+    }
+    /**
+     * Roles with a hypothesis (role_hyp >= 0) are filled by rows
+     * allowed by their delta beta, others by rows with their pid
+     */
+    inline combos_t MakeCombinations(const ROOT::RVecI& pid, const ROOT::RVec<short>& charge, const pid_hypotheses_t& hyp, const ROOT::RVecI& role_pids, const ROOT::RVecI& role_hyp, float max_dbeta,
+				     size_t max_combos, EventArena& arena, unsigned int slot, ULong64_t entry){
+      auto accept = [&](size_t ir,size_t ip){
+	if(role_hyp[ir]<0) return pid[ip]==role_pids[ir];
+	return IsHypothesisCandidate(hyp,role_hyp[ir],ip,role_pids[ir],pid[ip],charge[ip],max_dbeta);
+      };
+      return MakeCombinations(pid.size(),role_pids.size(),accept,max_combos,arena,slot,entry);
+    }
+
+    /**
+     * Sum 4-vectors of the given roles for every combination, sign = +-1
+     * added to (e,x,y,z) which must hold ncombos entries.
+     * Masses are role_masses[role] if given (>=0), else m[row]
+     */
+    template<typename Tp, typename Tm>
+    void SumCombos(const combos_t& combos, const ROOT::RVecI& roles, double sign,
+		   const ROOT::RVec<Tp>& px, const ROOT::RVec<Tp>& py, const ROOT::RVec<Tp>& pz, const ROOT::RVec<Tm>& m,
+		   double* e, double* x, double* y, double* z, const ROOT::RVecD& role_masses={}){
+      for(size_t ic=0;ic<combos.ncombos;++ic){
+	for(auto ir:roles){
+	  auto row = combos.Row(ic,ir);
+	  const double rx = px[row];
+	  const double ry = py[row];
+	  const double rz = pz[row];
+	  const double rm = (role_masses.empty() || role_masses[ir]<0) ? m[row] : role_masses[ir];
+	  x[ic] += sign*rx;
+	  y[ic] += sign*ry;
+	  z[ic] += sign*rz;
+	  e[ic] += sign*std::sqrt(rx*rx + ry*ry + rz*rz + rm*rm);
+	}
+      }
+    }
+    /**
+     * Invariant mass squared of each combination's 4-vector
+     */
+    inline void MassSquared(size_t n, const double* e, const double* x, const double* y, const double* z, double* out){
+      for(size_t i=0;i<n;++i) out[i] = e[i]*e[i] - x[i]*x[i] - y[i]*y[i] - z[i]*z[i];
+    }
+    /**
+     * Signed mass as ROOT::Math::LorentzVector::M()
+     */
+    inline void MassFromSquared(size_t n, double* m2){
+      for(size_t i=0;i<n;++i) m2[i] = m2[i]<0 ? -std::sqrt(-m2[i]) : std::sqrt(m2[i]);
+    }
+    /**
+     * Index of the combination with value closest to target, -1 if none
+     */
+    inline int BestCombo(const ROOT::RVecD& vals, double target){
+      int best = -1;
+      double best_diff = 0;
+      for(size_t i=0;i<vals.size();++i){
+	auto diff = std::abs(vals[i]-target);
+	if(best==-1 || diff<best_diff){
+	  best = i;
+	  best_diff = diff;
+	}
+      }
+      return best;
+    }
+
+    //! Class definition
+
+    class Combinatorics {
+
+    public:
+      /**
+       * name prefixes all the columns made
+       * roles = {{"scat_ele",11},{"pip",211},...}
+       */
+      Combinatorics(CLAS12Reaction& cr, const string& name, const std::vector<std::pair<string,int>>& roles, size_t max_combos=1000) :
+	_cr{cr}, _name{name}, _maxCombos{max_combos} {
+	for(const auto& role:roles){
+	  _roles.push_back(role.first);
+	  _rolePids.push_back(role.second);
+	}
+	MakeCombos();
+      }
+      /**
+       * Roles with a pid in hypotheses take any track its delta beta
+       * allows, and the role mass. Other roles, e.g. scat_ele, use the EB pid.
+       */
+      Combinatorics(CLAS12Reaction& cr, const string& name, const std::vector<std::pair<string,int>>& roles, const PidHypotheses& hypotheses, size_t max_combos=1000) :
+	_cr{cr}, _name{name}, _maxCombos{max_combos} {
+	for(const auto& role:roles){
+	  _roles.push_back(role.first);
+	  _rolePids.push_back(role.second);
+	  auto ih = hypotheses.Index(role.second);
+	  _roleHyp.push_back(ih);
+	  _roleMasses.push_back(ih<0 ? -1 : PdgToMass(role.second));
+	}
+	MakeHypothesisCombos(hypotheses);
+      }
+
+      /**
+       * By default the beam fixed in the CLAS12Reaction is used,
+       * this gives these combinations a different one
+       */
+      void FixBeamElectronMomentum(double x,double y,double z){_beamEle={x,y,z};_beamFixed=true;}
+      /**
+       * Take the beam energy (along z) per event from a column,
+       * e.g. beam_energy from CLAS12Reaction::LoadRunConditions
+       */
+      void UseBeamEnergyColumn(const string& col="beam_energy"){_beamCol=col;}
+      void FixTargetMass(double m){_targetMass=m;}
+
+      /**
+       * Per combination columns, name_colname, one entry per combination
+       */
+      void Mass(const string& col, const std::vector<string>& particles){
+	DefineKinematics(col,particles,{},false,false,true);
+      }
+      void MissMass(const string& col, const std::vector<string>& particles){
+	DefineKinematics(col,{},particles,true,true,true);
+      }
+      void MissMass2(const string& col, const std::vector<string>& particles){
+	DefineKinematics(col,{},particles,true,true,false);
+      }
+      /**
+       * t between target and the baryon particles
+       */
+      void TBot(const string& col, const std::vector<string>& baryons){
+	DefineKinematics(col,{},baryons,false,true,false);
+      }
+      /**
+       * t between the virtual photon and the mesons,
+       * give the scattered electron and the mesons
+       * e.g. TTop("tt",{"scat_ele","kp","km"})
+       */
+      void TTop(const string& col, const std::vector<string>& ele_mesons){
+	DefineKinematics(col,{},ele_mesons,true,false,false);
+      }
+      
+      /**
+       * Choose the combination with col closest to target
+       * and set the particle indices of the reaction from it.
+       * Must be called before makeParticleMap.
+       * Events with no combinations are filtered.
+       * Not for hypothesis combinations, as the rad kinematics of
+       * the chosen rows would use rec_m, the EB mass, not the role mass.
+       */
+      void UseBest(const string& col, double target=0);
+
+      string Col(const string& col) const {return _name+"_"+col;}
+      string CombosCol() {return _name+"_combos"+_cr.DoNotWriteTag();}
+      
+    private:
+
+      void MakeCombos();
+      void MakeHypothesisCombos(const PidHypotheses& hypotheses);
+      void DefineKinematics(const string& col, const std::vector<string>& plus, const std::vector<string>& minus, bool addBeam, bool addTarget, bool takeRoot);
+      template<typename Tp>
+      void DefineKinematicsT(const string& col, const ROOT::RVecI& plus, const ROOT::RVecI& minus, bool addBeam, bool addTarget, bool takeRoot);
+      ROOT::RVecI RoleIndices(const std::vector<string>& particles) const;
+      
+      CLAS12Reaction& _cr;
+      string _name;
+      size_t _maxCombos = 1000;
+      std::vector<string> _roles;
+      ROOT::RVecI _rolePids;
+      ROOT::RVecI _roleHyp;
+      ROOT::RVecD _roleMasses;
+      std::array<double,3> _beamEle = {0,0,0};
+      bool _beamFixed = false;
+      string _beamCol;
+      double _targetMass = 0.93827210;
+    };
+
+    /////////Class method implementations below
+    /**
+     * Define the per event combinations and their number name_n
+     */
+    void Combinatorics::MakeCombos(){
+      auto arena = _cr.Arena();
+      auto role_pids = _rolePids;
+      auto max_combos = _maxCombos;
+      _cr.DefineColumn(CombosCol(),[arena,role_pids,max_combos](const ROOT::RVecI& pid,unsigned int slot,ULong64_t entry){
+	  return MakeCombinations(pid,role_pids,max_combos,*arena,slot,entry);
+	},{Rec()+"pid","rdfslot_","rdfentry_"});
+      _cr.DefineColumn(Col("n"),[](const combos_t& combos){return combos.ncombos;},{CombosCol()});
+    }
+    void Combinatorics::MakeHypothesisCombos(const PidHypotheses& hypotheses){
+      auto arena = _cr.Arena();
+      auto role_pids = _rolePids;
+      auto role_hyp = _roleHyp;
+      auto max_dbeta = hypotheses.MaxDBeta();
+      auto max_combos = _maxCombos;
+      _cr.DefineColumn(CombosCol(),[arena,role_pids,role_hyp,max_dbeta,max_combos](const ROOT::RVecI& pid,const ROOT::RVec<short>& charge,const pid_hypotheses_t& hyp,unsigned int slot,ULong64_t entry){
+	  return MakeCombinations(pid,charge,hyp,role_pids,role_hyp,max_dbeta,max_combos,*arena,slot,entry);
+	},{Rec()+"pid",hypotheses.ChargeCol(),hypotheses.HypothesesCol(),"rdfslot_","rdfentry_"});
+      _cr.DefineColumn(Col("n"),[](const combos_t& combos){return combos.ncombos;},{CombosCol()});
+    }
+    /**
+     * Positions of the named particles in the role list
+     */
+    ROOT::RVecI Combinatorics::RoleIndices(const std::vector<string>& particles) const{
+      ROOT::RVecI indices;
+      for(const auto& particle:particles){
+	auto it = std::find(_roles.begin(),_roles.end(),particle);
+	if(it==_roles.end()){
+	  throw std::logic_error("Combinatorics "+_name+" no particle "+particle);
+	}
+	indices.push_back(it-_roles.begin());
+      }
+      return indices;
+    }
+    /**
+     * 4-vector = sum(plus) + beam + target - sum(minus) for every combination
+     * then its mass squared, or signed mass if takeRoot
+     */
+    void Combinatorics::DefineKinematics(const string& col, const std::vector<string>& plus, const std::vector<string>& minus, bool addBeam, bool addTarget, bool takeRoot){
+      auto ptype = _cr.CurrFrame().GetColumnType(Rec()+"px");
+      if(ptype.find("double")!=std::string::npos) DefineKinematicsT<double>(col,RoleIndices(plus),RoleIndices(minus),addBeam,addTarget,takeRoot);
+      else DefineKinematicsT<float>(col,RoleIndices(plus),RoleIndices(minus),addBeam,addTarget,takeRoot);
+    }
+    template<typename Tp>
+    void Combinatorics::DefineKinematicsT(const string& col, const ROOT::RVecI& plus, const ROOT::RVecI& minus, bool addBeam, bool addTarget, bool takeRoot){
+      auto arena = _cr.Arena();
+      if(_beamFixed==false && _cr.IsBeamFixed()==false && _beamCol.empty() && addBeam){
+	throw std::logic_error("Combinatorics "+_name+" "+col+" needs the beam, call FixBeamElectronMomentum on the reaction first");
+      }
+      auto fixed = _beamFixed ? _beamEle : _cr.BeamElectronMomentum();
+      auto target_mass = _targetMass;
+      auto beam_col = _beamCol;
+      auto role_masses = _roleMasses;
+      if(beam_col.empty()){
+	beam_col = Col("beam_pz")+_cr.DoNotWriteTag();
+	if(_cr.CurrFrame().HasColumn(beam_col)==false) _cr.DefineColumn(beam_col,[fixed](){return fixed[2];},{});
+      }
+      _cr.DefineColumn(Col(col),[=](const combos_t& combos,const ROOT::RVec<Tp>& px,const ROOT::RVec<Tp>& py,const ROOT::RVec<Tp>& pz,const ROOT::RVecD& m,double beam_pz,unsigned int slot,ULong64_t entry){
+	  const std::array<double,3> beam = {fixed[0],fixed[1],beam_pz};
+	  const auto n = combos.ncombos;
+	  auto e = arena->template Allocate<double>(slot,entry,n);
+	  auto x = arena->template Allocate<double>(slot,entry,n);
+	  auto y = arena->template Allocate<double>(slot,entry,n);
+	  auto z = arena->template Allocate<double>(slot,entry,n);
+	  const double ebeam = std::sqrt(beam[0]*beam[0]+beam[1]*beam[1]+beam[2]*beam[2]);
+	  for(size_t i=0;i<n;++i){
+	    e[i] = (addBeam ? ebeam : 0) + (addTarget ? target_mass : 0);
+	    x[i] = addBeam ? beam[0] : 0;
+	    y[i] = addBeam ? beam[1] : 0;
+	    z[i] = addBeam ? beam[2] : 0;
+	  }
+	  SumCombos(combos,plus,+1,px,py,pz,m,e,x,y,z,role_masses);
+	  SumCombos(combos,minus,-1,px,py,pz,m,e,x,y,z,role_masses);
+	  auto result = arena->template Adopt<double>(slot,entry,n);
+	  MassSquared(n,e,x,y,z,result.data());
+	  if(takeRoot) MassFromSquared(n,result.data());
+	  return result;
+	},{CombosCol(),Rec()+"px",Rec()+"py",Rec()+"pz",Rec()+"m",beam_col,"rdfslot_","rdfentry_"});
+    }
+    /**
+     * Set particle indices from the best combination
+     */
+    void Combinatorics::UseBest(const string& col, double target){
+      if(std::any_of(_roleHyp.begin(),_roleHyp.end(),[](int ih){return ih>=0;})){
+	throw std::logic_error("Combinatorics "+_name+" UseBest with PidHypotheses roles, the reaction kinematics would use the EB masses");
+      }
+      auto best = Col("best");
+      _cr.DefineColumn(best,[target](const ROOT::RVecD& vals){return BestCombo(vals,target);},{Col(col)});
+      _cr.DefineFilter(_name+"_has_combo",[](int ibest){return ibest>=0;},{best});
+
+      const auto nroles = _roles.size();
+      for(size_t ir=0;ir<nroles;++ir){
+	auto index = [ir](const combos_t& combos,int ibest){
+	  return static_cast<int>(combos.Row(ibest,ir));
+	};
+	if(_roles[ir]=="scat_ele") _cr.setScatElectronIndex(index,{CombosCol(),best});
+	else _cr.setParticleIndex(_roles[ir],index,{CombosCol(),best},_rolePids[ir]);
+      }
+    }
+    
+  }//clas12
+}//rad
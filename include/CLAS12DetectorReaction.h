@@ -21,33 +21,146 @@ namespace rad{
 
     /**
      *  Function to align detector element with particle entry = index
-     *  needs modification for case multiple entries per particle
+     *  returns the first entry, see ParticleLayerRows for all entries
      */
     template<typename T>
-      T ParticleDetInfo(const int index, const ROOT::RVec<ROOT::RVec<Short_t>>& indices, const ROOT::RVec<T>& vals){
-      // std::cout<<" ParticleDetInfo "<<index<<" "<<indices<<" "<<vals<<std::endl;
-      if(index>indices.size()) return 0;
-      if(indices[index].empty()==true) return 0;
-      return vals[ indices[index].front() ];
+      T ParticleDetInfo(const int index, const detector_index_t& indices, const ROOT::RVec<T>& vals){
+      if(index<0 || indices.empty(index)) return 0;
+      return vals[ indices.front(index) ];
     }
     
     /**
      *  Function to align detector element with particle entry = index
-     *  needs modification for case multiple entries per particle
+     *  returns the first entry, see ParticleLayerRows for all entries
      */
-    template<typename T>
-      T ParticleSubDetInfo(const int index, const ROOT::RVec<ROOT::RVec<Short_t>>& indices, const ROOT::RVec<T>& vals, const ROOT::RVec<Int_t>& detector, Int_t detid){
-      //std::cout<<" ParticleSubDetInfo "<<index<<" "<<indices<<" "<<vals<<detector<<detid<<std::endl;
-      if(index>indices.size()) return 0;
-      if(indices[index].empty()==true) return 0;
+    template<typename T, typename Td>
+      T ParticleSubDetInfo(const int index, const detector_index_t& indices, const ROOT::RVec<T>& vals, const ROOT::RVec<Td>& detector, Int_t detid){
+      if(index<0 || indices.empty(index)) return 0;
       //only return value if for requested sub detector
-      for(auto pentry: indices[index]){
+      for(auto ientry=indices.begin(index);ientry<indices.end(index);++ientry){
+	auto pentry = indices.rows[ientry];
 	if(detector[  pentry ] != detid ) continue;
 	return vals[ pentry ];
       }
       return 0;
     }
     
+    /**
+     *  Function to find the detector rows of a particle entry = index
+     *  for each of the requested sub detectors, -1 if no hit.
+     *  Only loops over the hits of this particle, so all particles
+     *  together cost a single pass over the detector bank.
+     *  Td is the type of the bank detector item.
+     */
+    template<typename Td>
+      ROOT::RVec<short> ParticleSubDetRows(const int index, const detector_index_t& indices, const ROOT::RVec<Td>& detector, const ROOT::RVec<Int_t>& subdets){
+      ROOT::RVec<short> rows(subdets.size(),-1);
+      if(index<0 || indices.empty(index)) return rows;
+      for(auto ientry=indices.begin(index);ientry<indices.end(index);++ientry){
+	auto pentry = indices.rows[ientry];
+	for(size_t isub=0;isub<subdets.size();++isub){
+	  //keep first entry for each sub detector
+	  if(rows[isub]==-1 && detector[ pentry ] == subdets[isub] ) rows[isub] = pentry;
+	}
+      }
+      return rows;
+    }
+    /**
+     *  Function to return detector value for a row found with ParticleSubDetRows
+     */
+    template<typename T>
+      T DetRowValue(const short row, const ROOT::RVec<T>& vals){
+      if(row<0 || row>=static_cast<int>(vals.size())) return 0;
+      return vals[ row ];
+    }
+
+    /**
+     *  Function to find all detector rows of a particle entry = index
+     *  in detector detid, grouped by the requested layers, e.g.
+     *  ECAL {PCAL,ECIN,ECOUT}. Rows of layer i are
+     *  result.rows[result.begin(i)] to result.rows[result.end(i)-1]
+     *  Only loops over the hits of this particle.
+     *  Td and Tl are the types of the bank detector and layer items.
+     */
+    template<typename Td, typename Tl>
+      detector_index_t ParticleLayerRows(const int index, const detector_index_t& indices, const ROOT::RVec<Td>& detector, const ROOT::RVec<Tl>& layer, const Int_t detid, const ROOT::RVec<Int_t>& layers){
+      const auto nlayers = layers.size();
+      detector_index_t result;
+      result.offsets.resize(nlayers+1,0);
+      if(index<0 || indices.empty(index)) return result;
+      //count hits per layer
+      for(auto ientry=indices.begin(index);ientry<indices.end(index);++ientry){
+	auto pentry = indices.rows[ientry];
+	if(detector[ pentry ] != detid ) continue;
+	for(size_t il=0;il<nlayers;++il) result.offsets[il+1] += (layer[ pentry ] == layers[il]);
+      }
+      for(size_t il=0;il<nlayers;++il) result.offsets[il+1] += result.offsets[il];
+      result.rows.resize(result.offsets[nlayers]);
+      //fill rows keeping bank order within a layer
+      ROOT::RVec<short> next(result.offsets.begin(),result.offsets.end()-1);
+      for(auto ientry=indices.begin(index);ientry<indices.end(index);++ientry){
+	auto pentry = indices.rows[ientry];
+	if(detector[ pentry ] != detid ) continue;
+	for(size_t il=0;il<nlayers;++il)
+	  if(layer[ pentry ] == layers[il]) result.rows[next[il]++] = pentry;
+      }
+      return result;
+    }
+    /**
+     *  Values of an item for rows found with ParticleLayerRows,
+     *  first hit of each layer (0 if none) followed by the
+     *  sum and max of all hits, result has nlayers+2 entries
+     */
+    template<typename T>
+      void LayerValues(const detector_index_t& lrows, const ROOT::RVec<T>& vals, T* result){
+      const auto nlayers = lrows.size();
+      T sum = 0;
+      T max = lrows.rows.empty() ? 0 : vals[lrows.rows[0]];
+      for(size_t il=0;il<nlayers;++il){
+	result[il] = lrows.empty(il) ? 0 : vals[lrows.front(il)];
+	for(auto ientry=lrows.begin(il);ientry<lrows.end(il);++ientry){
+	  const T val = vals[ lrows.rows[ientry] ];
+	  sum += val;
+	  max = std::max(max,val);
+	}
+      }
+      result[nlayers] = sum;
+      result[nlayers+1] = max;
+    }
+
+    /**
+     *  Cut on an item, e.g. trajectory edge, of the first hit in each
+     *  layer found with ParticleLayerRows, value >= min_vals[layer].
+     *  Layers without a hit fail only if require_hits
+     */
+    template<typename T>
+      bool PassLayerCuts(const detector_index_t& lrows, const ROOT::RVec<T>& vals, const ROOT::RVec<T>& min_vals, const bool require_hits){
+      const auto nlayers = lrows.size();
+      for(size_t il=0;il<nlayers;++il){
+	if(lrows.empty(il)){
+	  if(require_hits) return false;
+	  continue;
+	}
+	if(vals[lrows.front(il)] < min_vals[il]) return false;
+      }
+      return true;
+    }
+
+#ifdef CLAS12RAD_PRECOMPILED
+    //instantiated in CLAS12Precompiled.C, see Load.C
+    extern template float DetRowValue<float>(const short,const ROOT::RVec<float>&);
+    extern template ROOT::RVec<short> ParticleSubDetRows<char>(const int,const detector_index_t&,const ROOT::RVec<char>&,const ROOT::RVec<Int_t>&);
+    extern template ROOT::RVec<short> ParticleSubDetRows<short>(const int,const detector_index_t&,const ROOT::RVec<short>&,const ROOT::RVec<Int_t>&);
+    extern template ROOT::RVec<short> ParticleSubDetRows<int>(const int,const detector_index_t&,const ROOT::RVec<int>&,const ROOT::RVec<Int_t>&);
+    extern template detector_index_t ParticleLayerRows<char,char>(const int,const detector_index_t&,const ROOT::RVec<char>&,const ROOT::RVec<char>&,const Int_t,const ROOT::RVec<Int_t>&);
+    extern template detector_index_t ParticleLayerRows<short,short>(const int,const detector_index_t&,const ROOT::RVec<short>&,const ROOT::RVec<short>&,const Int_t,const ROOT::RVec<Int_t>&);
+    extern template detector_index_t ParticleLayerRows<int,int>(const int,const detector_index_t&,const ROOT::RVec<int>&,const ROOT::RVec<int>&,const Int_t,const ROOT::RVec<Int_t>&);
+    extern template detector_index_t ParticleLayerRows<int,char>(const int,const detector_index_t&,const ROOT::RVec<int>&,const ROOT::RVec<char>&,const Int_t,const ROOT::RVec<Int_t>&);
+    extern template detector_index_t ParticleLayerRows<int,short>(const int,const detector_index_t&,const ROOT::RVec<int>&,const ROOT::RVec<short>&,const Int_t,const ROOT::RVec<Int_t>&);
+    extern template void LayerValues<float>(const detector_index_t&,const ROOT::RVec<float>&,float*);
+    extern template bool PassLayerCuts<float>(const detector_index_t&,const ROOT::RVec<float>&,const ROOT::RVec<float>&,const bool);
+#endif
+
     //! Class definition
 
     class CLAS12DetectorReaction : public CLAS12Reaction {
@@ -62,8 +175,23 @@ namespace rad{
 	}
       CLAS12DetectorReaction(const std::vector<std::string> &filenames ) : CLAS12Reaction{ filenames } {
  
+      }
+      CLAS12DetectorReaction(const std::vector<std::string> &filenames, const EventIndexQuery& query ) : CLAS12Reaction{ filenames, query } {
+ 
+      }
+      CLAS12DetectorReaction(const shard_t& shard ) : CLAS12Reaction{ shard } {
+ 
       }
 
+	/**
+	 * Associate detector bank items with named particles
+	 * e.g. AssociateDetector("Scintillator",{FTOF,CTOF},{"pip"},{"energy","time"})
+	 * gives columns pip_FTOF_energy, pip_CTOF_energy, pip_FTOF_time, pip_CTOF_time
+	 * T is the type of the bank items (float for energy, time, path,...)
+	 * All columns are compiled, no JIT, and the detector bank is scanned once
+	 * per event, the individual columns just look up the found row.
+	 */
+	template<typename T=float>
 	void AssociateDetector(const string& det, const std::vector<int>& subdets, const std::vector<string>& particles, const std::vector<string>& info){
 
 	  std::string det_col{"REC_"};
@@ -71,43 +199,179 @@ namespace rad{
 
 	  // Define mapping from detector index to REC::Particle index
 	  // many detector hits may go to a single particle
-	  auto det_to_rec = det+"_to_rec" + DoNotWriteTag();
-  	  Define(det_to_rec ,rad::clas12::ReverseIndexN<short,unsigned long>,{det_col+"pindex",Rec()+"n"});
-
-	  /* //Now map sub-detector label to REC::Particle using det_to_rec */
-	  /* [](int subdet, const ROOT::RVec<Short_t>& indices, const ROOT::RVec<T>& vals){ */
-	  /*   ROOT::VecOps::Take(vals,indices); */
-	  /* } */
-	  /* Define(subdet+"_index", */
-	  /* 	 Form("rad::clas12::ParticleDetInfo(%s,%s,%s)",particle.data(),(det+"_to_rec").data(), (det_col+"detector").data()) ); */
+	  auto det_to_rec = DetectorToRec(det);
+
+	  ROOT::RVec<Int_t> subdet_ids(subdets.begin(),subdets.end());
+
+	  for(const auto& particle:particles){
+	    //rows in detector bank for this particle, one per subdet
+	    auto rows = particle+"_"+det+"_rows" + DoNotWriteTag();
+	    DispatchItemType(det,"detector",[&](auto dtag){
+		using Td = typename decltype(dtag)::type;
+		DefineColumn(rows,[subdet_ids](const int index, const detector_index_t& indices, const ROOT::RVec<Td>& detector){
+		    return rad::clas12::ParticleSubDetRows(index,indices,detector,subdet_ids);
+		  },{particle,det_to_rec,det_col+"detector"});
+	      });
+
+	    for(const auto& item:info){
+	      for(size_t isub=0;isub<subdets.size();++isub){
+		auto col_name = particle+"_"+ _detectors.DetName(subdets[isub])+"_"+item;
+		DefineColumn(col_name,[isub](const ROOT::RVec<short>& prows, const ROOT::RVec<T>& vals){
+		    return rad::clas12::DetRowValue(prows[isub],vals);
+		  },{rows,det_col+item});
+		std::cout<<"Define particle/detector column : "<<col_name<<std::endl;
+	      }
+	    }
+	  }
+
+	}
+
+	/**
+	 * Associate all hits in layers of one detector with named particles
+	 * e.g. AssociateDetectorLayers("Calorimeter",ECAL,{PCAL,ECIN,ECOUT},{"scat_ele"},{"energy"})
+	 * gives columns
+	 *   scat_ele_ECAL_energy     : array, first hit in each layer {PCAL,ECIN,ECOUT}
+	 *   scat_ele_ECAL_energy_sum : sum of all hits in these layers
+	 *   scat_ele_ECAL_energy_max : largest hit
+	 *   scat_ele_ECAL_nhits      : array, number of hits in each layer
+	 * The hits of each particle are found once for all layers and items.
+	 * sums=false leaves out _sum and _max, e.g. for positions.
+	 */
+	template<typename T=float>
+	void AssociateDetectorLayers(const string& det, const int detid, const std::vector<int>& layers, const std::vector<string>& particles, const std::vector<string>& info, bool sums=true){
+	  DispatchDetectorLayerTypes(det,[&](auto dtag,auto ltag){
+	      AssociateDetectorLayersT<T,typename decltype(dtag)::type,typename decltype(ltag)::type>(det,detid,layers,particles,info,sums);
+	    });
+	}
+
+	/**
+	 * Associate REC::Traj positions at layers with named particles
+	 * e.g. AssociateTrajectory(DC,{DC1,DC3,DC6},{"scat_ele"})
+	 * gives arrays, one entry per layer, scat_ele_DC_x, _y, _z and _edge
+	 */
+	void AssociateTrajectory(const int detid, const std::vector<int>& layers, const std::vector<string>& particles, const std::vector<string>& info={"x","y","z","edge"}){
+	  AssociateDetectorLayers<float>("Traj",detid,layers,particles,info,false);
+	}
+	
+	/**
+	 * Compiled Filter on the REC::Traj edge of each particle
+	 * at DC layers, edge >= min_edge, e.g. {{DC1,3},{DC3,3},{DC6,10}} cm.
+	 * Particles with no hit at a layer (e.g. central) pass
+	 * unless require_hits. One Filter per particle, particle_DC_fiducial
+	 */
+	void DCFiducialCut(const std::vector<string>& particles, const std::vector<std::pair<int,float>>& min_edge={{DC1,3},{DC3,3},{DC6,10}}, bool require_hits=false){
+	  DispatchDetectorLayerTypes("Traj",[&](auto dtag,auto ltag){
+	      FiducialCutT<typename decltype(dtag)::type,typename decltype(ltag)::type>(DC,particles,min_edge,require_hits);
+	    });
+	}
+	
+    private :
+
+	/**
+	 * Call func with a tag for the type of a bank item column,
+	 * e.g. detector or layer, short, int or byte (char)
+	 */
+	template<typename Func>
+	void DispatchItemType(const string& det, const string& item, Func&& func){
+	  auto itype = CurrFrame().GetColumnType("REC_"+det+"_"+item);
+	  if(itype.find("short")!=std::string::npos || itype.find("Short_t")!=std::string::npos) func(item_tag<short>{});
+	  else if(itype.find("int")!=std::string::npos || itype.find("Int_t")!=std::string::npos) func(item_tag<int>{});
+	  else func(item_tag<char>{});
+	}
+	template<typename Func>
+	void DispatchDetectorLayerTypes(const string& det, Func&& func){
+	  DispatchItemType(det,"detector",[&](auto dtag){
+	      DispatchItemType(det,"layer",[&](auto ltag){func(dtag,ltag);});
+	    });
+	}
+	template<typename T> struct item_tag{ using type = T; };
+
+	template<typename Td, typename Tl>
+	void FiducialCutT(const int detid, const std::vector<string>& particles, const std::vector<std::pair<int,float>>& min_edge, bool require_hits){
+	  const string det{"Traj"};
+	  std::string det_col{"REC_"};
+	  det_col+=det+"_";
+	  auto det_to_rec = DetectorToRec(det);
+
+	  ROOT::RVec<Int_t> layer_ids;
+	  ROOT::RVecF min_vals;
+	  for(const auto& cut:min_edge){
+	    layer_ids.push_back(cut.first);
+	    min_vals.push_back(cut.second);
+	  }
+	  const auto det_name = _detectors.DetName(detid);
 	  
+	  for(const auto& particle:particles){
+	    auto name = particle+"_"+det_name+"_fiducial";
+	    setCurrFrame(CurrFrame().Filter([detid,layer_ids,min_vals,require_hits](const int index, const detector_index_t& indices, const ROOT::RVec<Td>& detector, const ROOT::RVec<Tl>& layer, const ROOT::RVecF& edge){
+		  auto lrows = rad::clas12::ParticleLayerRows(index,indices,detector,layer,detid,layer_ids);
+		  return rad::clas12::PassLayerCuts(lrows,edge,min_vals,require_hits);
+		},{particle,det_to_rec,det_col+"detector",det_col+"layer",det_col+"edge"},name));
+	  }
+	}
+	
+	/**
+	 * Reverse index of the detector bank, shared by all
+	 * associations of the same detector
+	 */
+	string DetectorToRec(const string& det){
+	  std::string det_col{"REC_"};
+	  det_col+=det+"_";
+	  auto det_to_rec = det+"_to_rec" + DoNotWriteTag();
+	  if(CurrFrame().HasColumn(det_to_rec)) return det_to_rec;
+	  DefineColumn(det_to_rec ,rad::clas12::ReverseIndexFlat<unsigned long>,{det_col+"pindex",Rec()+"n"});
+
 	  if(IsTruthMatched()){
-	    Redefine(det_to_rec,helpers::Rearrange<ROOT::RVec<short>,short>,{det_to_rec,Rec()+"match_id"});
+	    Redefine(det_to_rec,rad::clas12::RearrangeIndex<short>,{det_to_rec,Rec()+"match_id"});
 	  }
+	  return det_to_rec;
+	}
+	
+	template<typename T,typename Td,typename Tl>
+	void AssociateDetectorLayersT(const string& det, const int detid, const std::vector<int>& layers, const std::vector<string>& particles, const std::vector<string>& info, bool sums){
+	  std::string det_col{"REC_"};
+	  det_col+=det+"_";
+	  auto det_to_rec = DetectorToRec(det);
+	  auto arena = Arena();
+	  
+	  ROOT::RVec<Int_t> layer_ids(layers.begin(),layers.end());
+	  const auto nlayers = layer_ids.size();
+	  const auto det_name = _detectors.DetName(detid);
 
 	  for(const auto& particle:particles){
+	    auto prefix = particle+"_"+det_name+"_";
+	    //rows in detector bank for this particle, grouped by layer
+	    auto lrows = prefix+"layer_rows" + DoNotWriteTag();
+	    DefineColumn(lrows,[detid,layer_ids](const int index, const detector_index_t& indices, const ROOT::RVec<Td>& detector, const ROOT::RVec<Tl>& layer){
+		return rad::clas12::ParticleLayerRows(index,indices,detector,layer,detid,layer_ids);
+	      },{particle,det_to_rec,det_col+"detector",det_col+"layer"});
+	    DefineColumn(prefix+"nhits",[](const detector_index_t& lrows){
+		ROOT::RVec<short> nhits(lrows.size());
+		for(size_t il=0;il<nhits.size();++il) nhits[il] = lrows.end(il)-lrows.begin(il);
+		return nhits;
+	      },{lrows});
+	    
 	    for(const auto& item:info){
-	      // Use JIT compilation, can't use templates as need to know at run time
-	      // could get the column type at runtime, but this is easier
-	      // and PArticleDetInfo is simple so I do not expect slow down
-	      // just some JIT overhead
-	      
-	      /* Define(particle+"_"+det+"_"+item, */
-	      /* 	     Form("rad::clas12::ParticleDetInfo(%s,%s,%s)",particle.data(),(det+"_to_rec").data(), (det_col+item).data()) ); */
-
-	      for(const auto& subdet:subdets){
-		Define(particle+"_"+ _detectors.DetName(subdet)+"_"+item,
-		       Form("rad::clas12::ParticleSubDetInfo(%s,%s,%s,%s,%d)",particle.data(),(det_to_rec).data(), (det_col+item).data(),(det_col+"detector").data(), subdet) );
-		std::cout<<"Define particle/detector column : "<<particle+"_"+ _detectors.DetName(subdet)+"_"+item<<std::endl;
+	      auto col_name = prefix+item;
+	      auto all = col_name+"_layers" + DoNotWriteTag();
+	      DefineColumn(all,[arena,nlayers](const detector_index_t& lrows, const ROOT::RVec<T>& vals, unsigned int slot, ULong64_t entry){
+		  auto result = arena->template Adopt<T>(slot,entry,nlayers+2);
+		  rad::clas12::LayerValues(lrows,vals,result.data());
+		  return result;
+		},{lrows,det_col+item,"rdfslot_","rdfentry_"});
+	      //views of the layer values, sum and max
+	      DefineColumn(col_name,[nlayers](const ROOT::RVec<T>& vals){
+		  return ROOT::RVec<T>(const_cast<T*>(vals.data()),nlayers);
+		},{all});
+	      if(sums){
+		DefineColumn(col_name+"_sum",[nlayers](const ROOT::RVec<T>& vals){return vals[nlayers];},{all});
+		DefineColumn(col_name+"_max",[nlayers](const ROOT::RVec<T>& vals){return vals[nlayers+1];},{all});
 	      }
-	      
+	      std::cout<<"Define particle/detector layer columns : "<<col_name<<(sums ? " (_sum, _max)" : "")<<std::endl;
 	    }
 	  }
-	  
-	  
 	}
-
-    private :
+	
 	clas12::DetId2Name _detectors;
 	
     };//class def
@@ -0,0 +1,157 @@
+#pragma once
+
+//!  Per slot memory arena for per event RVec columns
+
+/*!
+  Column functions take their output arrays from the arena rather
+  than making a new RVec each event. The RVec returned to RDataFrame
+  adopts the arena memory, so nothing is copied. The arena of a slot
+  is reset when that slot moves to a new entry, so once it has grown
+  to the largest event there are no more heap allocations.
+  Memory is only valid for the entry it was allocated in.
+*/
+#include <ROOT/RVec.hxx>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+#include <iostream>
+
+namespace rad{
+  namespace clas12 {
+
+    /**
+     * Bump allocator for one processing slot
+     * cache line aligned so slots do not share counters
+     */
+    class alignas(64) SlotArena {
+
+    public:
+
+      /**
+       * Reset if this is a new entry
+       */
+      void NewEntry(ULong64_t entry){
+	if(entry==_entry && _nevents!=0) return;
+	Reset();
+	_entry = entry;
+	++_nevents;
+      }
+      
+      void* Allocate(size_t bytes){
+	++_nrequests;
+	bytes = (bytes + Alignment - 1) & ~(Alignment - 1);
+	if(_blocks.empty() || _used + bytes > _blocks.back().size) Grow(bytes);
+	auto ptr = _blocks.back().data.get() + _used;
+	_used += bytes;
+	_eventBytes += bytes;
+	return ptr;
+      }
+
+      size_t NEvents() const {return _nevents;}
+      size_t NRequests() const {return _nrequests;}
+      size_t NHeapAllocations() const {return _nheap;}
+      size_t PeakBytes() const {return std::max(_peakBytes,_eventBytes);}
+      
+    private:
+
+      static constexpr size_t Alignment = alignof(std::max_align_t);
+      static constexpr size_t InitialSize = 4096;
+
+      struct block_t{
+	std::unique_ptr<char[]> data;
+	size_t size = 0;
+      };
+
+      void Grow(size_t bytes){
+	//earlier blocks are still in use this event, so keep them
+	size_t size = _blocks.empty() ? InitialSize : 2*_blocks.back().size;
+	size = std::max(size,bytes);
+	_blocks.push_back(block_t{std::unique_ptr<char[]>(new char[size]),size});
+	_used = 0;
+	++_nheap;
+      }
+      void Reset(){
+	//merge blocks so next event fits in one
+	if(_blocks.size()>1){
+	  size_t total = 0;
+	  for(const auto& block:_blocks) total += block.size;
+	  _blocks.clear();
+	  _blocks.push_back(block_t{std::unique_ptr<char[]>(new char[total]),total});
+	  ++_nheap;
+	}
+	_peakBytes = std::max(_peakBytes,_eventBytes);
+	_eventBytes = 0;
+	_used = 0;
+      }
+
+      std::vector<block_t> _blocks;
+      size_t _used = 0;
+      ULong64_t _entry = 0;
+      
+      size_t _nevents = 0;
+      size_t _nrequests = 0;
+      size_t _nheap = 0;
+      size_t _eventBytes = 0;
+      size_t _peakBytes = 0;
+    };
+
+    /**
+     * One SlotArena per RDataFrame slot
+     */
+    class EventArena {
+
+    public:
+
+      EventArena(unsigned int nslots) : _slots(nslots) {}
+
+      /**
+       * n uninitialised elements valid for this entry
+       */
+      template<typename T>
+      T* Allocate(unsigned int slot, ULong64_t entry, size_t n){
+	static_assert(std::is_trivially_destructible<T>::value,"EventArena only holds trivial types");
+	auto& arena = _slots[slot];
+	arena.NewEntry(entry);
+	if(n==0) return nullptr;
+	return static_cast<T*>(arena.Allocate(n*sizeof(T)));
+      }
+      /**
+       * RVec of n uninitialised elements, adopting arena memory
+       */
+      template<typename T>
+      ROOT::RVec<T> Adopt(unsigned int slot, ULong64_t entry, size_t n){
+	auto ptr = Allocate<T>(slot,entry,n);
+	if(ptr==nullptr) return ROOT::RVec<T>();
+	return ROOT::RVec<T>(ptr,n);
+      }
+
+      unsigned int NSlots() const {return _slots.size();}
+      
+      /**
+       * Allocations per event. Without the arena each request
+       * would have been a new RVec, with it only block growth
+       * goes to the heap.
+       */
+      void Report() const {
+	size_t nevents = 0, nrequests = 0, nheap = 0, peak = 0;
+	for(const auto& arena:_slots){
+	  nevents += arena.NEvents();
+	  nrequests += arena.NRequests();
+	  nheap += arena.NHeapAllocations();
+	  peak = std::max(peak,arena.PeakBytes());
+	}
+	std::cout<<"EventArena "<<nevents<<" events over "<<_slots.size()<<" slots"<<std::endl;
+	if(nevents==0) return;
+	std::cout<<"  column arrays per event (allocations without arena) : "<<static_cast<double>(nrequests)/nevents<<std::endl;
+	std::cout<<"  heap allocations per event with arena               : "<<static_cast<double>(nheap)/nevents<<" ("<<nheap<<" in total)"<<std::endl;
+	std::cout<<"  peak bytes for one event                            : "<<peak<<std::endl;
+      }
+      
+    private:
+
+      std::vector<SlotArena> _slots;
+    };
+
+  }//clas12
+}//rad
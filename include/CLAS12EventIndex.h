@@ -0,0 +1,298 @@
+#pragma once
+
+//!  Per file event index sidecar for hipo files
+
+/*!
+  One pass over a hipo file records, for every event, the run and
+  event numbers, the trigger word and the number of REC::Particle rows
+  of some common pids. It is saved next to the file as file.radidx
+  and rebuilt if the hipo file changes. A query on the counts selects
+  the events to analyse; files with no selected events are not opened.
+
+  Index layout :
+    "RADIDX01", hipo file size, hipo mtime, npids, pids[npids], nevents
+    then per event : run, event (int32), trigger (uint64),
+		     nparticles, counts[npids] (uint8, saturated at 255)
+*/
+#include "hipo4/reader.h"
+#include <ROOT/RVec.hxx>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <sys/stat.h>
+#include <glob.h>
+
+namespace rad{
+  namespace clas12 {
+    using std::string;
+
+    /**
+     * Events to select, same meaning as CLAS12Reaction::PreSelect.
+     * At least count particles of each pid, which must be one of
+     * the indexed pids, between min_n and max_n particles and if
+     * trigger_mask is not 0, at least one of its trigger bits set.
+     */
+    struct EventIndexQuery{
+      std::vector<std::pair<int,int>> pid_counts;
+      size_t min_n = 0;
+      size_t max_n = 255;
+      uint64_t trigger_mask = 0;
+    };
+    
+    //! Class definition
+
+    class EventIndex {
+
+    public:
+
+      static constexpr char Magic[] = "RADIDX01";
+
+      /**
+       * Pids counted by default
+       */
+      static std::vector<int> DefaultPids(){return {11,-11,22,211,-211,321,-321,2212,2112};}
+      
+      /**
+       * Load the sidecar of hipofile, building and saving it
+       * if it does not exist or is out of date
+       */
+      static EventIndex BuildOrLoad(const string& hipofile,const std::vector<int>& pids=DefaultPids()){
+	EventIndex index;
+	if(index.Load(hipofile) && index._pids==pids) return index;
+	index.Build(hipofile,pids);
+	index.Save();
+	return index;
+      }
+      static string SidecarName(const string& hipofile){return hipofile+".radidx";}
+
+      void Build(const string& hipofile,const std::vector<int>& pids);
+      bool Load(const string& hipofile);
+      void Save() const;
+      
+      /**
+       * One flag per event of the file
+       */
+      std::vector<bool> Select(const EventIndexQuery& query) const;
+
+      size_t NEvents() const {return _runs.size();}
+      const std::vector<int>& Pids() const {return _pids;}
+      int Run(size_t ev) const {return _runs[ev];}
+      int Event(size_t ev) const {return _events[ev];}
+      uint64_t Trigger(size_t ev) const {return _triggers[ev];}
+      int NParticles(size_t ev) const {return _nparticles[ev];}
+      int Count(size_t ev,int pid) const {
+	auto it = std::find(_pids.begin(),_pids.end(),pid);
+	return it==_pids.end() ? -1 : _counts[ev*_pids.size()+(it-_pids.begin())];
+      }
+      
+    private:
+
+      static bool FileStamp(const string& file,uint64_t& size,uint64_t& mtime){
+	struct stat st;
+	if(stat(file.data(),&st)!=0) return false;
+	size = st.st_size;
+	mtime = st.st_mtime;
+	return true;
+      }
+      
+      string _hipofile;
+      uint64_t _fileSize = 0;
+      uint64_t _fileTime = 0;
+      std::vector<int> _pids;
+      std::vector<int32_t> _runs;
+      std::vector<int32_t> _events;
+      std::vector<uint64_t> _triggers;
+      std::vector<uint8_t> _nparticles;
+      std::vector<uint8_t> _counts; //[event][pid]
+    };
+
+    /////////Class method implementations below
+    /**
+     * Single pass over REC::Particle and RUN::config
+     */
+    void EventIndex::Build(const string& hipofile,const std::vector<int>& pids){
+      _hipofile = hipofile;
+      _pids = pids;
+      _runs.clear(); _events.clear(); _triggers.clear(); _nparticles.clear(); _counts.clear();
+      FileStamp(hipofile,_fileSize,_fileTime);
+
+      hipo::reader reader;
+      reader.open(hipofile.data());
+      hipo::dictionary factory;
+      reader.readDictionary(factory);
+      if(factory.hasSchema("REC::Particle")==false){
+	throw std::runtime_error("EventIndex "+hipofile+" has no REC::Particle bank");
+      }
+      bool hasConfig = factory.hasSchema("RUN::config");
+      hipo::bank particles(factory.getSchema("REC::Particle"));
+      hipo::bank config(hasConfig ? factory.getSchema("RUN::config") : hipo::schema{});
+      hipo::event event;
+
+      const auto npids = _pids.size();
+      std::vector<int> counts(npids);
+      while(reader.next()){
+	reader.read(event);
+	event.getStructure(particles);
+	int run = 0, evnum = 0;
+	uint64_t trigger = 0;
+	if(hasConfig){
+	  event.getStructure(config);
+	  if(config.getRows()>0){
+	    run = config.getInt("run",0);
+	    evnum = config.getInt("event",0);
+	    trigger = config.getLong("trigger",0);
+	  }
+	}
+	const int rows = particles.getRows();
+	std::fill(counts.begin(),counts.end(),0);
+	for(int i=0;i<rows;++i){
+	  const int pid = particles.getInt("pid",i);
+	  for(size_t ip=0;ip<npids;++ip) counts[ip] += (pid==_pids[ip]);
+	}
+	_runs.push_back(run);
+	_events.push_back(evnum);
+	_triggers.push_back(trigger);
+	_nparticles.push_back(std::min(rows,255));
+	for(auto c:counts) _counts.push_back(std::min(c,255));
+      }
+    }
+
+    bool EventIndex::Load(const string& hipofile){
+      _hipofile = hipofile;
+      uint64_t size = 0, mtime = 0;
+      if(FileStamp(hipofile,size,mtime)==false) return false;
+      std::ifstream in(SidecarName(hipofile),std::ios::binary);
+      if(!in) return false;
+      
+      char magic[8];
+      in.read(magic,8);
+      if(!in || std::memcmp(magic,Magic,8)!=0) return false;
+      auto get = [&in](auto& val){in.read(reinterpret_cast<char*>(&val),sizeof(val));};
+      get(_fileSize);
+      get(_fileTime);
+      if(_fileSize!=size || _fileTime!=mtime) return false; //out of date
+      uint32_t npids = 0;
+      get(npids);
+      _pids.resize(npids);
+      for(auto& pid:_pids){int32_t p; get(p); pid=p;}
+      uint64_t nevents = 0;
+      get(nevents);
+      _runs.resize(nevents);
+      _events.resize(nevents);
+      _triggers.resize(nevents);
+      _nparticles.resize(nevents);
+      _counts.resize(nevents*npids);
+      for(uint64_t ev=0;ev<nevents;++ev){
+	get(_runs[ev]);
+	get(_events[ev]);
+	get(_triggers[ev]);
+	get(_nparticles[ev]);
+	in.read(reinterpret_cast<char*>(_counts.data()+ev*npids),npids);
+      }
+      return static_cast<bool>(in);
+    }
+
+    void EventIndex::Save() const{
+      std::ofstream out(SidecarName(_hipofile),std::ios::binary);
+      if(!out){
+	std::cerr<<"EventIndex could not write "<<SidecarName(_hipofile)<<", index only kept in memory"<<std::endl;
+	return;
+      }
+      auto put = [&out](auto val){out.write(reinterpret_cast<const char*>(&val),sizeof(val));};
+      out.write(Magic,8);
+      put(_fileSize);
+      put(_fileTime);
+      put(static_cast<uint32_t>(_pids.size()));
+      for(auto pid:_pids) put(static_cast<int32_t>(pid));
+      put(static_cast<uint64_t>(NEvents()));
+      const auto npids = _pids.size();
+      for(size_t ev=0;ev<NEvents();++ev){
+	put(_runs[ev]);
+	put(_events[ev]);
+	put(_triggers[ev]);
+	put(_nparticles[ev]);
+	out.write(reinterpret_cast<const char*>(_counts.data()+ev*npids),npids);
+      }
+    }
+
+    std::vector<bool> EventIndex::Select(const EventIndexQuery& query) const{
+      std::vector<size_t> cols;
+      for(const auto& pc:query.pid_counts){
+	auto it = std::find(_pids.begin(),_pids.end(),pc.first);
+	if(it==_pids.end()){
+	  throw std::runtime_error("EventIndex pid "+std::to_string(pc.first)+" is not indexed in "+_hipofile);
+	}
+	cols.push_back(it-_pids.begin());
+      }
+      const auto npids = _pids.size();
+      std::vector<bool> selected(NEvents());
+      for(size_t ev=0;ev<NEvents();++ev){
+	bool pass = _nparticles[ev]>=query.min_n && _nparticles[ev]<=query.max_n;
+	if(query.trigger_mask!=0) pass = pass && (_triggers[ev]&query.trigger_mask)!=0;
+	for(size_t iq=0;iq<cols.size() && pass;++iq)
+	  pass = _counts[ev*npids+cols[iq]]>=query.pid_counts[iq].second;
+	selected[ev] = pass;
+      }
+      return selected;
+    }
+
+    /**
+     * Expand a file glob, sorted so the entry order is reproducible
+     */
+    inline std::vector<string> ExpandFileGlob(const string& pattern){
+      std::vector<string> files;
+      glob_t result;
+      if(glob(pattern.data(),GLOB_TILDE,nullptr,&result)==0){
+	for(size_t i=0;i<result.gl_pathc;++i) files.push_back(result.gl_pathv[i]);
+      }
+      globfree(&result);
+      std::sort(files.begin(),files.end());
+      return files;
+    }
+    
+    /**
+     * Files with selected events and one flag per event
+     * of those files, in the order they are given to RHipoDS,
+     * no flags for all events
+     */
+    struct index_selection_t{
+      std::vector<string> files;
+      std::shared_ptr<std::vector<bool>> selected = std::make_shared<std::vector<bool>>();
+      std::shared_ptr<std::vector<int>> events = std::make_shared<std::vector<int>>(); //RUN::config event of each entry, if known
+    };
+    
+    inline index_selection_t SelectIndexedEvents(const std::vector<string>& patterns,const EventIndexQuery& query){
+      index_selection_t result;
+      size_t nall = 0;
+      string first_file;
+      for(const auto& pattern:patterns){
+	for(const auto& file:ExpandFileGlob(pattern)){
+	  auto index = EventIndex::BuildOrLoad(file);
+	  auto flags = index.Select(query);
+	  if(first_file.empty()) first_file = file;
+	  nall += flags.size();
+	  if(std::find(flags.begin(),flags.end(),true)==flags.end()) continue; //skip file
+	  result.files.push_back(file);
+	  result.selected->insert(result.selected->end(),flags.begin(),flags.end());
+	  for(size_t ev=0;ev<index.NEvents();++ev) result.events->push_back(index.Event(ev));
+	}
+      }
+      if(result.files.empty() && first_file.empty()==false){
+	//no event passed, keep one file with every flag false so
+	//the reaction is valid and gives empty outputs
+	result.files.push_back(first_file);
+	result.selected->assign(EventIndex::BuildOrLoad(first_file).NEvents(),false);
+	result.events->clear();
+      }
+      auto nsel = std::count(result.selected->begin(),result.selected->end(),true);
+      std::cout<<"EventIndex selected "<<nsel<<" of "<<nall<<" events in "<<result.files.size()<<" files"<<std::endl;
+      return result;
+    }
+    
+  }//clas12
+}//rad
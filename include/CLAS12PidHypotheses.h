@@ -0,0 +1,228 @@
+#pragma once
+
+//!  Several mass hypotheses per track from momentum and beta
+
+/*!
+  The event builder gives one pid per track. Here every charged track
+  is compared to a list of hadron hypotheses, e.g. pi, K, p, using
+  delta beta = beta - p/sqrt(p^2+m^2). The delta betas of one event
+  are stored hypothesis by hypothesis (one contiguous array each) in
+  EventArena memory, so each hypothesis is one branch free loop over
+  the tracks. From them come per hypothesis columns name_dbeta_label,
+  the pid of the closest hypothesis name_pid, and candidates for
+  Combinatorics, which then makes every role assignment allowed
+  by the hypotheses and uses the hypothesis masses, so K and pi
+  analyses of the same tracks share one pass over the data.
+*/
+#include "CLAS12Reaction.h"
+#include "CLAS12EventArena.h"
+#include <ROOT/RVec.hxx>
+#include <cmath>
+#include <vector>
+#include <stdexcept>
+
+namespace rad{
+  namespace clas12 {
+
+    /**
+     * One mass hypothesis, positive pdg code and a label for column names
+     */
+    struct hypothesis_t{
+      int pdg;
+      string label;
+    };
+
+    /**
+     * Delta beta of one event, memory owned by the EventArena
+     * dbeta[ih*n + i] for hypothesis ih and track i
+     * pid[i] = closest hypothesis within the cut, or the EB pid
+     */
+    struct pid_hypotheses_t{
+      float* dbeta = nullptr;
+      int* pid = nullptr;
+      size_t n = 0;
+      size_t nhyp = 0;
+
+      float* DBeta(size_t ih) const {return dbeta + ih*n;}
+    };
+
+    /**
+     * dbeta[i] = beta[i] - p/sqrt(p^2+m^2) for one mass
+     * p/sqrt(p^2+m^2) is written sqrt(p^2/(p^2+m^2)), no branches
+     */
+    template<typename Tp, typename Tb>
+    void FillDeltaBeta(size_t n, const Tp* px, const Tp* py, const Tp* pz, const Tb* beta, double mass, float* dbeta){
+      const double m2 = mass*mass;
+      for(size_t i=0;i<n;++i){
+	const double p2 = double(px[i])*px[i] + double(py[i])*py[i] + double(pz[i])*pz[i];
+	dbeta[i] = beta[i] - std::sqrt(p2/(p2+m2));
+      }
+    }
+#ifdef CLAS12RAD_PRECOMPILED
+    //instantiated in CLAS12Precompiled.C, see Load.C
+    extern template void FillDeltaBeta<float,float>(size_t,const float*,const float*,const float*,const float*,double,float*);
+    extern template void FillDeltaBeta<double,double>(size_t,const double*,const double*,const double*,const double*,double,float*);
+#endif
+    /**
+     * Charged hadron tracks are given hypotheses, leptons
+     * identified by the EB (calorimeter, HTCC) are not
+     */
+    inline bool HasHypotheses(int ebpid, short charge){
+      const int apid = std::abs(ebpid);
+      return (charge!=0) & (apid!=11) & (apid!=13);
+    }
+    /**
+     * Pid of the hypothesis with the smallest |dbeta| below max_dbeta,
+     * signed by the track charge. Other tracks keep their EB pid.
+     * best is scratch of n floats.
+     */
+    inline void FillBestHypothesis(size_t n, size_t nhyp, const float* dbeta, const ROOT::RVecI& hyp_pdg, float max_dbeta,
+				   const ROOT::RVecI& ebpid, const ROOT::RVec<short>& charge, float* best, int* pid){
+      for(size_t i=0;i<n;++i){
+	best[i] = max_dbeta;
+	pid[i] = 0;
+      }
+      for(size_t ih=0;ih<nhyp;++ih){
+	const float* db = dbeta + ih*n;
+	const int pdg = hyp_pdg[ih];
+	for(size_t i=0;i<n;++i){
+	  const float adb = std::abs(db[i]);
+	  const bool closer = adb < best[i];
+	  best[i] = closer ? adb : best[i];
+	  pid[i] = closer ? pdg : pid[i];
+	}
+      }
+      for(size_t i=0;i<n;++i){
+	const bool use = (pid[i]!=0) & HasHypotheses(ebpid[i],charge[i]);
+	pid[i] = use ? (charge[i]>0 ? pid[i] : -pid[i]) : ebpid[i];
+      }
+    }
+    /**
+     * Can track i be particle pdg under hypothesis ih
+     */
+    inline bool IsHypothesisCandidate(const pid_hypotheses_t& hyp, size_t ih, size_t i, int pdg, int ebpid, short charge, float max_dbeta){
+      return HasHypotheses(ebpid,charge) & ((charge>0)==(pdg>0)) & (std::abs(hyp.DBeta(ih)[i])<max_dbeta);
+    }
+
+    //! Class definition
+
+    class PidHypotheses {
+
+    public:
+      /**
+       * Needs rec_beta and rec_charge, so beta and charge must be in
+       * ReadParticleItems, charge is not by default. The charge is that of the
+       * REC::Particle track, so tracks with EB pid 0 are given
+       * hypotheses too, e-/e+ and mu-/mu+ keep their EB pid.
+       * Call after AliasColumns.
+       * e.g. PidHypotheses hyp{rf,"hyp",{{211,"pi"},{321,"K"},{2212,"p"}},0.02};
+       */
+      PidHypotheses(CLAS12Reaction& cr, const string& name, const std::vector<hypothesis_t>& hypotheses={{211,"pi"},{321,"K"},{2212,"p"}}, float max_dbeta=0.02) :
+	_cr{cr}, _name{name}, _maxDBeta{max_dbeta} {
+	for(const auto& hyp:hypotheses){
+	  _pdgs.push_back(std::abs(hyp.pdg));
+	  _labels.push_back(hyp.label);
+	}
+	Define();
+      }
+
+      /**
+       * Index of the hypothesis for pdg (either sign), -1 if none
+       */
+      int Index(int pdg) const{
+	for(size_t ih=0;ih<_pdgs.size();++ih) if(_pdgs[ih]==std::abs(pdg)) return ih;
+	return -1;
+      }
+      float MaxDBeta() const {return _maxDBeta;}
+      string Col(const string& col) const {return _name+"_"+col;}
+      string HypothesesCol() const {return _name+"_hypotheses"+_cr.DoNotWriteTag();}
+      /**
+       * Track charge as short, whatever the bank item type
+       */
+      string ChargeCol() const {return _name+"_charge"+_cr.DoNotWriteTag();}
+
+    private:
+
+      void Define();
+      template<typename Tp, typename Tb>
+      void DefineT();
+      template<typename Tc>
+      void DefineCharge();
+
+      CLAS12Reaction& _cr;
+      string _name;
+      float _maxDBeta = 0.02;
+      ROOT::RVecI _pdgs;
+      std::vector<string> _labels;
+    };
+
+    /////////Class method implementations below
+    /**
+     * Dispatch on the charge, momentum and beta column types
+     */
+    void PidHypotheses::Define(){
+      for(const auto& item:{"beta","charge"}){
+	if(_cr.CurrFrame().HasColumn(Rec()+item)==false){
+	  throw std::logic_error("PidHypotheses "+_name+" needs "+Rec()+item+", add "+item+" to ReadParticleItems");
+	}
+      }
+      auto ctype = _cr.CurrFrame().GetColumnType(Rec()+"charge");
+      if(ctype.find("short")!=std::string::npos) DefineCharge<short>();
+      else if(ctype.find("int")!=std::string::npos) DefineCharge<int>();
+      else DefineCharge<Char_t>();
+      
+      auto pdouble = _cr.CurrFrame().GetColumnType(Rec()+"px").find("double")!=std::string::npos;
+      auto bdouble = _cr.CurrFrame().GetColumnType(Rec()+"beta").find("double")!=std::string::npos;
+      if(pdouble && bdouble) DefineT<double,double>();
+      else if(pdouble) DefineT<double,float>();
+      else if(bdouble) DefineT<float,double>();
+      else DefineT<float,float>();
+    }
+    template<typename Tc>
+    void PidHypotheses::DefineCharge(){
+      auto arena = _cr.Arena();
+      _cr.DefineColumn(ChargeCol(),[arena](const ROOT::RVec<Tc>& charge,unsigned int slot,ULong64_t entry){
+	  auto result = arena->template Adopt<short>(slot,entry,charge.size());
+	  for(size_t i=0;i<charge.size();++i) result[i] = charge[i];
+	  return result;
+	},{Rec()+"charge","rdfslot_","rdfentry_"});
+    }
+    /**
+     * All hypotheses of an event in one kernel, then views of it
+     */
+    template<typename Tp, typename Tb>
+    void PidHypotheses::DefineT(){
+      auto arena = _cr.Arena();
+      auto pdgs = _pdgs;
+      auto max_dbeta = _maxDBeta;
+      _cr.DefineColumn(HypothesesCol(),[arena,pdgs,max_dbeta](const ROOT::RVec<Tp>& px,const ROOT::RVec<Tp>& py,const ROOT::RVec<Tp>& pz,const ROOT::RVec<Tb>& beta,
+							      const ROOT::RVecI& ebpid,const ROOT::RVec<short>& charge,unsigned int slot,ULong64_t entry){
+	  pid_hypotheses_t result;
+	  const auto n = px.size();
+	  const auto nhyp = pdgs.size();
+	  auto dbeta = arena->template Allocate<float>(slot,entry,n*nhyp);
+	  auto pid = arena->template Allocate<int>(slot,entry,n);
+	  auto best = arena->template Allocate<float>(slot,entry,n);
+	  for(size_t ih=0;ih<nhyp;++ih){
+	    FillDeltaBeta(n,px.data(),py.data(),pz.data(),beta.data(),PdgToMass(pdgs[ih]),dbeta+ih*n);
+	  }
+	  FillBestHypothesis(n,nhyp,dbeta,pdgs,max_dbeta,ebpid,charge,best,pid);
+	  result.dbeta = dbeta;
+	  result.pid = pid;
+	  result.n = n;
+	  result.nhyp = nhyp;
+	  return result;
+	},{Rec()+"px",Rec()+"py",Rec()+"pz",Rec()+"beta",Rec()+"pid",ChargeCol(),"rdfslot_","rdfentry_"});
+
+      for(size_t ih=0;ih<_pdgs.size();++ih){
+	_cr.DefineColumn(Col("dbeta_"+_labels[ih]),[ih](const pid_hypotheses_t& hyp){
+	    return ROOT::RVecF(hyp.DBeta(ih),hyp.n);
+	  },{HypothesesCol()});
+      }
+      _cr.DefineColumn(Col("pid"),[](const pid_hypotheses_t& hyp){
+	  return ROOT::RVecI(hyp.pid,hyp.n);
+	},{HypothesesCol()});
+    }
+
+  }//clas12
+}//rad
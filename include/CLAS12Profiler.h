@@ -0,0 +1,304 @@
+#pragma once
+
+//!  Opt-in timing of the columns a CLAS12Reaction defines
+
+/*!
+  Compiled column functions are wrapped so each call is timed, with
+  call counts and a log2 latency histogram kept per processing slot.
+  JIT compile and event loop times are taken from the RDataFrame log,
+  and the cut flow of the named Filters gives events/s after each one.
+  Time not spent in timed columns (hipo I/O, JIT'd string columns,
+  framework) is reported as unaccounted.
+*/
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RLogger.hxx>
+#include <ROOT/TypeTraits.hxx>
+#include <chrono>
+#include <array>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <numeric>
+#include <algorithm>
+
+namespace rad{
+  namespace clas12 {
+    using std::string;
+
+    //! Class definition
+
+    class ColumnProfiler {
+
+    public:
+      using clock = std::chrono::steady_clock;
+      static constexpr size_t NBuckets = 40; //log2(ns)
+
+      struct stats_t{
+	ULong64_t calls = 0;
+	ULong64_t ns = 0;
+	std::array<ULong64_t,NBuckets> buckets{};
+      };
+      /**
+       * Information from the RDataFrame log, one entry per event loop
+       * jitSeconds[i] is the JIT compile time before loop i
+       */
+      struct log_t{
+	std::mutex mutex;
+	std::vector<double> jitSeconds;
+	std::vector<double> loopSeconds;
+	double pendingJIT = 0; //JIT of the loop not finished yet
+	ROOT::RDF::RResultPtr<ROOT::RDF::RCutFlowReport> cutflow;
+	int cutflowLoop = -1;
+      };
+
+      ColumnProfiler(unsigned int nslots) : _stats(nslots), _log{std::make_shared<log_t>()} {
+	StartLog();
+      }
+      ColumnProfiler(const ColumnProfiler&) = delete;
+      ~ColumnProfiler(){
+	ROOT::Experimental::RLogManager::Get().Remove(_handler);
+      }
+
+      /**
+       * Register a column before the event loop, returns its id
+       */
+      size_t Register(const string& name,const string& kind){
+	_names.push_back(name);
+	_kinds.push_back(kind);
+	for(auto& slot:_stats) slot.resize(_names.size());
+	return _names.size()-1;
+      }
+      void Record(unsigned int slot,size_t id,clock::duration elapsed){
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	auto& stats = _stats[slot][id];
+	++stats.calls;
+	stats.ns += ns;
+	size_t bucket = 0;
+	while((ns>>=1)>0 && bucket<NBuckets-1) ++bucket;
+	++stats.buckets[bucket];
+      }
+      
+      /**
+       * Book the cut flow of the Filters upstream of df
+       */
+      void BookCutFlow(ROOT::RDF::RNode df){_log->cutflow = df.Report();}
+      
+      /**
+       * Totals over all event loops so far, in seconds
+       */
+      double JITSeconds() const{
+	std::lock_guard<std::mutex> lock(_log->mutex);
+	return std::accumulate(_log->jitSeconds.begin(),_log->jitSeconds.end(),_log->pendingJIT);
+      }
+      double LoopSeconds() const{
+	std::lock_guard<std::mutex> lock(_log->mutex);
+	return std::accumulate(_log->loopSeconds.begin(),_log->loopSeconds.end(),0.);
+      }
+      size_t NLoops() const{
+	std::lock_guard<std::mutex> lock(_log->mutex);
+	return _log->loopSeconds.size();
+      }
+      /**
+       * JIT and event loop seconds of each finished event loop
+       */
+      std::vector<double> JITSecondsPerLoop() const{
+	std::lock_guard<std::mutex> lock(_log->mutex);
+	return _log->jitSeconds;
+      }
+      std::vector<double> LoopSecondsPerLoop() const{
+	std::lock_guard<std::mutex> lock(_log->mutex);
+	return _log->loopSeconds;
+      }
+      /**
+       * Events passing the last named Filter, needs ProfileFilters
+       */
+      ULong64_t NSelected() const{
+	std::lock_guard<std::mutex> lock(_log->mutex);
+	ULong64_t pass = 0;
+	if(_log->cutflow.IsReady()) for(auto&& cut : *_log->cutflow) pass = cut.GetPass();
+	return pass;
+      }
+      
+      void Print(std::ostream& os=std::cout) const;
+      void WriteJSON(const string& filename) const;
+
+    private:
+
+      /**
+       * Parse the RDataFrame info messages for JIT and event loop times
+       */
+      /**
+       * RDF messages are only raised to kInfo for the profiler,
+       * so those above the verbosity the user had are consumed
+       * (returning false stops other handlers printing them)
+       */
+      class LogHandler : public ROOT::Experimental::RLogHandler {
+      public:
+	LogHandler(std::shared_ptr<log_t> log,ROOT::Experimental::ELogLevel user_level) : _log{log}, _userLevel{user_level} {}
+	bool Emit(const ROOT::Experimental::RLogEntry& entry) override {
+	  if(entry.fChannel!=&ROOT::Detail::RDF::RDFLogChannel()) return true;
+	  const auto& msg = entry.fMessage;
+	  std::lock_guard<std::mutex> lock(_log->mutex);
+	  auto jit = msg.find("compilation phase completed in ");
+	  if(jit!=string::npos) _log->pendingJIT += std::atof(msg.data()+jit+31);
+	  auto loop = msg.find("Finished event loop number");
+	  auto cpu = msg.find("s CPU, ");
+	  if(loop!=string::npos && cpu!=string::npos){
+	    _log->jitSeconds.push_back(_log->pendingJIT);
+	    _log->pendingJIT = 0;
+	    _log->loopSeconds.push_back(std::atof(msg.data()+cpu+7));
+	    if(_log->cutflowLoop<0 && _log->cutflow.IsReady()) _log->cutflowLoop = _log->loopSeconds.size()-1;
+	  }
+	  return entry.fLevel<=_userLevel;
+	}
+      private:
+	std::shared_ptr<log_t> _log;
+	ROOT::Experimental::ELogLevel _userLevel;
+      };
+      
+      void StartLog(){
+	auto user_level = ROOT::Detail::RDF::RDFLogChannel().GetEffectiveVerbosity(ROOT::Experimental::RLogManager::Get());
+	_verbosity = std::make_unique<ROOT::Experimental::RLogScopedVerbosity>(ROOT::Detail::RDF::RDFLogChannel(),ROOT::Experimental::ELogLevel::kInfo);
+	auto handler = std::make_unique<LogHandler>(_log,user_level);
+	_handler = handler.get();
+	ROOT::Experimental::RLogManager::Get().PushFront(std::move(handler));
+      }
+      
+      stats_t Total(size_t id) const{
+	stats_t total;
+	for(const auto& slot:_stats){
+	  total.calls += slot[id].calls;
+	  total.ns += slot[id].ns;
+	  for(size_t ib=0;ib<NBuckets;++ib) total.buckets[ib] += slot[id].buckets[ib];
+	}
+	return total;
+      }
+      /**
+       * Upper edge in ns of the bucket containing quantile q
+       */
+      static double Quantile(const stats_t& stats,double q){
+	ULong64_t sum = 0;
+	for(size_t ib=0;ib<NBuckets;++ib){
+	  sum += stats.buckets[ib];
+	  if(sum>=q*stats.calls) return std::pow(2.,ib+1);
+	}
+	return std::pow(2.,NBuckets);
+      }
+      std::vector<size_t> SortedIds() const{
+	std::vector<size_t> ids(_names.size());
+	std::iota(ids.begin(),ids.end(),0);
+	std::vector<ULong64_t> ns(ids.size());
+	for(auto id:ids) ns[id] = Total(id).ns;
+	std::sort(ids.begin(),ids.end(),[&ns](size_t a,size_t b){return ns[a]>ns[b];});
+	return ids;
+      }
+      double CutFlowSeconds() const{
+	if(_log->loopSeconds.empty()) return 0;
+	return _log->loopSeconds[std::max(_log->cutflowLoop,0)];
+      }
+      
+      std::vector<string> _names;
+      std::vector<string> _kinds;
+      std::vector<std::vector<stats_t>> _stats; //[slot][column]
+      std::shared_ptr<log_t> _log;
+      std::unique_ptr<ROOT::Experimental::RLogScopedVerbosity> _verbosity;
+      ROOT::Experimental::RLogHandler* _handler = nullptr;
+    };
+
+    /**
+     * Wrap a column function so its calls are timed,
+     * rdfslot_ must be given as an extra last column
+     */
+    template<typename F,typename... Args>
+    auto ProfileCallable(F func,std::shared_ptr<ColumnProfiler> profiler,size_t id,ROOT::TypeTraits::TypeList<Args...>){
+      return [func,profiler,id](Args... args,unsigned int slot){
+	auto start = ColumnProfiler::clock::now();
+	auto result = func(std::forward<Args>(args)...);
+	profiler->Record(slot,id,ColumnProfiler::clock::now()-start);
+	return result;
+      };
+    }
+    template<typename F>
+    auto ProfileCallable(F func,std::shared_ptr<ColumnProfiler> profiler,size_t id){
+      using args_t = typename ROOT::TypeTraits::CallableTraits<F>::arg_types;
+      return ProfileCallable(func,profiler,id,args_t{});
+    }
+    
+    /////////Class method implementations below
+    void ColumnProfiler::Print(std::ostream& os) const{
+      std::lock_guard<std::mutex> lock(_log->mutex);
+      auto loops = std::accumulate(_log->loopSeconds.begin(),_log->loopSeconds.end(),0.);
+      auto jit = std::accumulate(_log->jitSeconds.begin(),_log->jitSeconds.end(),0.);
+      ULong64_t timed_ns = 0;
+      
+      os<<"ColumnProfiler "<<_log->loopSeconds.size()<<" event loops "<<loops<<" s, JIT "<<jit<<" s"<<std::endl;
+      for(size_t il=0;il<_log->loopSeconds.size();++il){
+	os<<"  loop "<<il<<" JIT "<<_log->jitSeconds[il]<<" s, event loop "<<_log->loopSeconds[il]<<" s"<<std::endl;
+      }
+      os<<std::left<<std::setw(40)<<"column"<<std::setw(14)<<"kind"<<std::right<<std::setw(12)<<"calls"<<std::setw(12)<<"total ms"<<std::setw(10)<<"mean ns"<<std::setw(10)<<"p50 ns"<<std::setw(10)<<"p99 ns"<<"   calls per slot"<<std::endl;
+      for(auto id:SortedIds()){
+	auto total = Total(id);
+	timed_ns += total.ns;
+	os<<std::left<<std::setw(40)<<_names[id]<<std::setw(14)<<_kinds[id]<<std::right<<std::setw(12)<<total.calls
+	  <<std::setw(12)<<std::fixed<<std::setprecision(2)<<total.ns*1E-6
+	  <<std::setw(10)<<std::setprecision(0)<<(total.calls ? double(total.ns)/total.calls : 0.)
+	  <<std::setw(10)<<Quantile(total,0.5)<<std::setw(10)<<Quantile(total,0.99)<<"  ";
+	for(const auto& slot:_stats) os<<" "<<slot[id].calls;
+	os<<std::defaultfloat<<std::endl;
+      }
+      auto slot_seconds = loops*_stats.size();
+      os<<"timed columns "<<timed_ns*1E-9<<" s of "<<slot_seconds<<" slot seconds, unaccounted (I/O, JIT'd columns, framework) "<<slot_seconds-timed_ns*1E-9<<" s"<<std::endl;
+
+      if(_log->cutflow.IsReady()){
+	auto seconds = CutFlowSeconds();
+	os<<"Filter throughput over "<<seconds<<" s"<<std::endl;
+	for(auto&& cut : *_log->cutflow){
+	  os<<std::left<<std::setw(20)<<cut.GetName()<<std::right<<" pass "<<std::setw(12)<<cut.GetPass()<<" of "<<std::setw(12)<<cut.GetAll()
+	    <<"  "<<(seconds>0 ? cut.GetPass()/seconds : 0.)<<" events/s"<<std::endl;
+	}
+      }
+    }
+    
+    void ColumnProfiler::WriteJSON(const string& filename) const{
+      std::lock_guard<std::mutex> lock(_log->mutex);
+      std::ofstream out(filename);
+      auto array = [&out](const auto& vals){
+	out<<"[";
+	for(size_t i=0;i<vals.size();++i) out<<(i ? "," : "")<<vals[i];
+	out<<"]";
+      };
+      out<<"{\n \"jit_seconds\": "; array(_log->jitSeconds);
+      out<<",\n \"loop_seconds\": "; array(_log->loopSeconds);
+      out<<",\n \"columns\": [";
+      bool first = true;
+      for(auto id:SortedIds()){
+	auto total = Total(id);
+	std::vector<ULong64_t> slots;
+	for(const auto& slot:_stats) slots.push_back(slot[id].calls);
+	out<<(first ? "\n" : ",\n")<<"  {\"name\": \""<<_names[id]<<"\", \"kind\": \""<<_kinds[id]<<"\", \"calls\": "<<total.calls<<", \"ns\": "<<total.ns<<", \"slot_calls\": ";
+	array(slots);
+	out<<", \"log2_ns_histogram\": ";
+	array(total.buckets);
+	out<<"}";
+	first = false;
+      }
+      out<<"\n ],\n \"filters\": [";
+      if(_log->cutflow.IsReady()){
+	auto seconds = CutFlowSeconds();
+	first = true;
+	for(auto&& cut : *_log->cutflow){
+	  out<<(first ? "\n" : ",\n")<<"  {\"name\": \""<<cut.GetName()<<"\", \"pass\": "<<cut.GetPass()<<", \"all\": "<<cut.GetAll()
+	     <<", \"events_per_second\": "<<(seconds>0 ? cut.GetPass()/seconds : 0.)<<"}";
+	  first = false;
+	}
+      }
+      out<<"\n ]\n}"<<std::endl;
+    }
+    
+  }//clas12
+}//rad
@@ -9,8 +9,26 @@
 */
 #include "ElectroIonReaction.h"
 #include "CLAS12Utilities.h"
+#include "CLAS12EventArena.h"
+#include "CLAS12Profiler.h"
+#include "CLAS12EventIndex.h"
+#include "CLAS12Shards.h"
+#include "CLAS12RunConditions.h"
 #include "ReactionUtilities.h"
 #include "hipo4/RHipoDS.hxx"
+#include <TFile.h>
+#include <TTree.h>
+#include <TTreeIndex.h>
+#include <TSystem.h>
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <utility>
+#include <set>
+#include <map>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
 
 namespace rad{
   namespace clas12 {
@@ -27,32 +45,262 @@ namespace rad{
 
       CLAS12Reaction(const std::string_view fileNameGlob ) :
 	rad::config::ElectroIonReaction{ ROOT::RDataFrame{std::move(std::make_unique<RHipoDS>(fileNameGlob))} } {
-
+	_files = ExpandFileGlob(string(fileNameGlob));
       }
 
       CLAS12Reaction(const std::vector<std::string> &filenames ) : rad::config::ElectroIonReaction{ROOT::RDataFrame{std::move(std::make_unique<RHipoDS>(filenames))}} {
- 
+	for(const auto& pattern:filenames){
+	  auto files = ExpandFileGlob(pattern);
+	  _files.insert(_files.end(),files.begin(),files.end());
+	}
+      }
+      /**
+       * Only process events selected by query on the EventIndex
+       * of each file (built and saved on first use).
+       * Files with no selected events are not read.
+       * If no event is selected, one file is kept with every
+       * event rejected, so the outputs are empty.
+       */
+      CLAS12Reaction(const std::vector<std::string> &filenames, const EventIndexQuery& query ) :
+	CLAS12Reaction{SelectIndexedEvents(filenames,query)} {
+	
+      }
+      /**
+       * Only process the files and event range of one shard,
+       * for a macro run by ShardRunner
+       */
+      CLAS12Reaction(const shard_t& shard ) : CLAS12Reaction{shard.Selection()} {
+	
       }
 
       void AliasColumns(Bool_t IsEnd=kTRUE);
       void AliasColumnsFTB(Bool_t IsEnd=kTRUE);
+      void AliasColumnsMerged(Bool_t IsEnd=kTRUE);
       void AliasColumnsMC(Bool_t IsEnd=kTRUE);
       void AliasColumnsAndMC(Bool_t IsEnd=kTRUE);
       void AliasColumnsAndMatchWithMC(Bool_t IsEnd=kTRUE);
       void PostParticles() override;
       void AddAdditionalComponents();
+      void AliasRunEvent();
+      using rad::config::ElectroIonReaction::Snapshot;
+      void Snapshot(const string& filename);
+      void Snapshot(const string& filename,const ROOT::RDF::ColumnNames_t& columns);
+      void SnapshotOrdered(const string& filename);
       template<typename T> 
       void RedefineFundamental( const string& name );
+      template<typename Tn>
+      void DefineMatchPermutation();
 
  
 
-      void UseFTB(){_isFTBased=true;}
+      void UseFTB(){
+	if(_preSelected) throw std::logic_error("CLAS12Reaction::UseFTB must be called before PreSelect");
+	_isFTBased=true;
+      }
+      /**
+       * Read both REC::Particle and RECFT::Particle and merge them
+       * per event (RECFT if it has an FT electron) or per particle
+       * (RECFT rows with a pid) into one set of rec columns.
+       * rec_ft flags the rows taken from RECFT.
+       * Must be called before PreSelect, which cuts on the merged rows.
+       */
+      void UseFTBMerged(ft_merge_t mode=ft_merge_t::PerEvent){
+	if(_preSelected) throw std::logic_error("CLAS12Reaction::UseFTBMerged must be called before PreSelect");
+	_ftMerge=true;
+	_ftMergeMode=mode;
+      }
       
       bool IsTruthMatched()const {return _truthMatched;}
+      string MatchPermutation() {return "match_perm"+DoNotWriteTag();}
+
+      /**
+       * Only alias these optional particle bank items, any of
+       * status,charge,vt,vx,vy,vz,beta,chi2pid, by default all but charge.
+       * Must be called before AliasColumns.
+       * Items not aliased are not written by Snapshot
+       * and so are never read from the hipo file.
+       */
+      void ReadParticleItems(const std::vector<string>& items){_particleItems = items;}
+
+      /**
+       * Filter events on the raw particle bank before anything else
+       * is calculated, requiring at least count particles of each pid,
+       * e.g. {{11,1},{211,1},{-211,1},{2212,1}}, and between min_n and
+       * max_n particles. Only particles in detector regions
+       * (1 FT, 2 FD, 4 CD) are counted, all if regions is empty.
+       * Must be called before AliasColumns and after UseFTB or
+       * UseFTBMerged, with which the merged rows are counted.
+       */
+      void PreSelect(const std::vector<std::pair<int,int>>& pid_counts,size_t min_n=0,size_t max_n=std::numeric_limits<size_t>::max(),const std::vector<int>& regions={});
 
+      /**
+       * Per slot arena for per event column arrays
+       * PrintArenaReport after processing gives allocations per event
+       */
+      std::shared_ptr<EventArena> Arena(){
+	if(_arena.get()==nullptr) _arena = std::make_shared<EventArena>(CurrFrame().GetNSlots());
+	return _arena;
+      }
+      void PrintArenaReport() const {if(_arena.get()) _arena->Report();}
+
+      /**
+       * Optional columns, the spherical components rec_/tru_ phi, theta,
+       * pmag and the resolutions res_, are only calculated if a Filter,
+       * histogram or other column uses them. They are not written by
+       * Snapshot unless kept, e.g. KeepColumns({"rec_pmag","res_pmag"}),
+       * or given in an explicit Snapshot column list.
+       * PrintPrunedColumns after processing lists what was skipped.
+       */
+      void KeepColumns(const ROOT::RDF::ColumnNames_t& columns){_keptColumns.insert(columns.begin(),columns.end());}
+      void KeepAllColumns(){_keepAllColumns=true;}
+      bool IsOptionalColumn(const string& name) const {return _optionalColumns.count(name)>0;}
+      ROOT::RDF::ColumnNames_t SnapshotColumns();
+      void PrintPrunedColumns(std::ostream& os=std::cout) const;
+
+      /**
+       * Per run beam energy, torus and solenoid from a csv dump,
+       * giving columns beam_energy, torus and solenoid
+       */
+      void LoadRunConditions(const string& csvfile);
+      std::shared_ptr<RunConditions> Conditions() const {return _conditions;}
+      /**
+       * Fix the beam electron momentum from the run conditions
+       * of the input files, which must all have the same beam energy,
+       * throws for mixed lists. The rad beam is one fixed vector, so
+       * only Combinatorics (UseBeamEnergyColumn) can take beam_energy
+       * per event; otherwise split the files with
+       * Conditions()->GroupFilesByBeamEnergy and process each group.
+       */
+      double FixBeamFromRunConditions();
+      const std::vector<string>& InputFiles() const {return _files;}
+      /**
+       * As the rad method, also recording the beam so
+       * Combinatorics uses the same one
+       */
+      template<typename... Args>
+      void FixBeamElectronMomentum(double x,double y,double z,Args&&... args){
+	rad::config::ElectroIonReaction::FixBeamElectronMomentum(x,y,z,std::forward<Args>(args)...);
+	_beamEle = {x,y,z};
+	_beamFixed = true;
+      }
+      bool IsBeamFixed() const {return _beamFixed;}
+      const std::array<double,3>& BeamElectronMomentum() const {return _beamEle;}
+
+      /**
+       * Opt-in timing of the compiled columns defined after this call.
+       * Call ProfileFilters after the last Filter, before processing,
+       * for events/s after each named Filter.
+       * PrintProfile or WriteProfileJSON after processing.
+       */
+      void EnableProfiling(){
+	if(_profiler.get()==nullptr) _profiler = std::make_shared<ColumnProfiler>(CurrFrame().GetNSlots());
+      }
+      bool IsProfiling() const {return _profiler.get()!=nullptr;}
+      void ProfileFilters(){if(IsProfiling()) _profiler->BookCutFlow(CurrFrame());}
+      void PrintProfile() const {if(IsProfiling()) _profiler->Print();}
+      void WriteProfileJSON(const string& filename) const {if(IsProfiling()) _profiler->WriteJSON(filename);}
+      const ColumnProfiler* Profiler() const {return _profiler.get();}
+
+      /**
+       * Define a compiled column, timed when profiling
+       */
+      template<typename Lambda>
+      void DefineColumn(const string& name,Lambda&& func,const ROOT::RDF::ColumnNames_t& columns,const string& kind="Define"){
+	if(IsProfiling()==false){
+	  Define(name,func,columns);
+	  return;
+	}
+	auto id = _profiler->Register(name,kind);
+	auto cols = columns;
+	cols.push_back("rdfslot_");
+	Define(name,ProfileCallable(func,_profiler,id),cols);
+      }
+      /**
+       * Compiled Filter named name, no JIT
+       */
+      template<typename Lambda>
+      void DefineFilter(const string& name,Lambda&& func,const ROOT::RDF::ColumnNames_t& columns){
+	setCurrFrame(CurrFrame().Filter(func,columns,name));
+      }
+
+    protected:
+
+      CLAS12Reaction(const index_selection_t& selection ) : rad::config::ElectroIonReaction{ROOT::RDataFrame{std::move(std::make_unique<RHipoDS>(CheckSelection(selection).files))}} {
+	_files = selection.files;
+	auto selected = selection.selected;
+	if(selected->empty()) return; //all events
+	//The flags are in the order of the events in the concatenated
+	//files, so rdfentry_ must count the RHipoDS events in that order.
+	//When the index has the RUN::config event numbers this is asserted.
+	auto events = selection.events;
+	bool hasEvents = events->size()==selected->size() && std::any_of(events->begin(),events->end(),[](int ev){return ev!=0;});
+	if(hasEvents==false){
+	  setCurrFrame(CurrFrame().Filter([selected](ULong64_t entry){
+		return entry<selected->size() && (*selected)[entry];
+	      },{"rdfentry_"},"index_query"));
+	  return;
+	}
+	setCurrFrame(CurrFrame().Filter([selected,events](ULong64_t entry,int event){
+	      if(entry>=selected->size() || (event!=0 && (*events)[entry]!=event)){
+		throw std::runtime_error("CLAS12Reaction index_query entry "+std::to_string(entry)+" is not the indexed event, rdfentry_ must follow the file order");
+	      }
+	      return bool((*selected)[entry]);
+	    },{"rdfentry_","RUN_config_event"},"index_query"));
+      }
+      static const index_selection_t& CheckSelection(const index_selection_t& selection){
+	if(selection.files.empty()){
+	  throw std::runtime_error("CLAS12Reaction no input files for the selection");
+	}
+	return selection;
+      }
+
+      void AliasParticleItems(const string& bank,const string& vertex_bank);
+
+      template<typename Lambda>
+      void DefineSlot(const string& name,Lambda&& func,const ROOT::RDF::ColumnNames_t& columns){
+	if(IsProfiling()){
+	  ROOT::RDF::ColumnNames_t cols = {"rdfslot_"};
+	  cols.insert(cols.end(),columns.begin(),columns.end());
+	  DefineColumn(name,func,cols,"DefineSlot");
+	}
+	else setCurrFrame(CurrFrame().DefineSlot(name,func,columns));
+      }
+      template<typename Lambda>
+      void DefineSlotEntry(const string& name,Lambda&& func,const ROOT::RDF::ColumnNames_t& columns){
+	if(IsProfiling()){
+	  ROOT::RDF::ColumnNames_t cols = {"rdfslot_","rdfentry_"};
+	  cols.insert(cols.end(),columns.begin(),columns.end());
+	  DefineColumn(name,func,cols,"DefineSlot");
+	}
+	else setCurrFrame(CurrFrame().DefineSlotEntry(name,func,columns));
+      }
+      void DefinePidColumns(const string& bank);
+      template<typename T>
+      void DefineSphericalComponents(const string& type);
+      template<typename Tp>
+      void DefineMergedParticles(const string& merged);
+      template<typename T>
+      void DefineMergedItem(const string& merged,const string& item);
+      
     private:
 
+      std::vector<string> _particleItems = {"status","vt","vx","vy","vz","beta","chi2pid"};
+      std::vector<string> _dataTypes;
+      std::shared_ptr<EventArena> _arena;
+      std::shared_ptr<ColumnProfiler> _profiler;
+      std::shared_ptr<RunConditions> _conditions;
+      std::set<string> _optionalColumns;
+      std::set<string> _keptColumns;
+      std::set<string> _writtenColumns;
+      std::map<string,std::shared_ptr<std::vector<char>>> _calculated; //[type][slot]
+      bool _keepAllColumns=false;
+      std::vector<string> _files;
       bool _isFTBased=false;     
+      bool _ftMerge=false;
+      bool _preSelected=false;
+      bool _beamFixed=false;
+      std::array<double,3> _beamEle = {0,0,0};
+      ft_merge_t _ftMergeMode=ft_merge_t::PerEvent;
       bool _truthMatched =false;
      
     };//CLAS12Reaction
@@ -63,26 +311,20 @@ namespace rad{
        * Only alias REC::Particles columns
        */ 
     void CLAS12Reaction::AliasColumns(Bool_t IsEnd){
+      if(_ftMerge) return AliasColumnsMerged();
       if(_isFTBased) return AliasColumnsFTB();
 	 
       AddType(Rec());
+      _dataTypes.push_back(Rec());
 
       setBranchAlias("REC_Particle_px",Rec()+"px");
       setBranchAlias("REC_Particle_py",Rec()+"py");
       setBranchAlias("REC_Particle_pz",Rec()+"pz");
       setBranchAlias("REC_Particle_pid",Rec()+"pid");
-      //create a column for particle masses
-      Define("REC_Particle_m",rad::clas12::AssignMasses,{Rec()+"pid"});
-      //need to alias it for redefines
-      setBranchAlias("REC_Particle_m",Rec()+"m");
-
-      setBranchAlias("REC_Particle_status",Rec()+"status");
-      setBranchAlias("REC_Particle_vt",Rec()+"vt");
-      setBranchAlias("REC_Particle_vx",Rec()+"vx");
-      setBranchAlias("REC_Particle_vy",Rec()+"vy");
-      setBranchAlias("REC_Particle_vz",Rec()+"vz");
-      setBranchAlias("REC_Particle_beta",Rec()+"beta");
-      setBranchAlias("REC_Particle_chi2pid",Rec()+"chi2pid");
+      //create columns for particle masses, charges and known species
+      DefinePidColumns("REC_Particle_");
+
+      AliasParticleItems("REC_Particle_","REC_Particle_");
 
       //Make a list of good particles
       //INPROCESS
@@ -94,33 +336,22 @@ namespace rad{
      * Only alias RECFT::Particles columns
      */ 
     void CLAS12Reaction::AliasColumnsFTB(Bool_t IsEnd){
-      //Actually would like to switch to
-      //REC::Particle if no RECFT entry, i.e. no FT electron
-      //Could make intermediate Defines instead,
-      //returning FTB by default
-      //and normal if no FT electron
-      //then alias the defines to rec_px etc
+      //To switch to REC::Particle if no FT electron
+      //use UseFTBMerged, see AliasColumnsMerged
 	 
       AddType(Rec());
+      _dataTypes.push_back(Rec());
       
-      Define(Rec()+"n",[](const ROOT::RVecD& px){return px.size();},{"RECFT_Particle_px"});
+      DefineColumn(Rec()+"n",[](const ROOT::RVecD& px){return px.size();},{"RECFT_Particle_px"});
    
       setBranchAlias("RECFT_Particle_px",Rec()+"px");
       setBranchAlias("RECFT_Particle_py",Rec()+"py");
       setBranchAlias("RECFT_Particle_pz",Rec()+"pz");
       setBranchAlias("RECFT_Particle_pid",Rec()+"pid");
-      //create a column for particle masses
-      Define("RECFT_Particle_m",rad::clas12::AssignMasses,{Rec()+"pid"});
-      //need to alias it for redefines
-      setBranchAlias("RECFT_Particle_m",Rec()+"m");
-
-      setBranchAlias("RECFT_Particle_status",Rec()+"status");
-      setBranchAlias("RECFT_Particle_vt",Rec()+"vt");
-      setBranchAlias("REC_Particle_vx",Rec()+"vx");
-      setBranchAlias("REC_Particle_vy",Rec()+"vy");
-      setBranchAlias("REC_Particle_vz",Rec()+"vz");
-      setBranchAlias("RECFT_Particle_beta",Rec()+"beta");
-      setBranchAlias("RECFT_Particle_chi2pid",Rec()+"chi2pid");
+      //create columns for particle masses, charges and known species
+      DefinePidColumns("RECFT_Particle_");
+
+      AliasParticleItems("RECFT_Particle_","REC_Particle_");
 
       //Make a list of good particles
       //INPROCESS
@@ -129,11 +360,131 @@ namespace rad{
       reaction::util::CountParticles(this,Rec());
     }
 
+    /**
+     * REC::Particle and RECFT::Particle merged in one compiled
+     * kernel into arena memory, then aliased to rec_ columns
+     */ 
+    void CLAS12Reaction::AliasColumnsMerged(Bool_t IsEnd){
+      AddType(Rec());
+      _dataTypes.push_back(Rec());
+
+      const string merged = "RECMERGED_Particle_";
+      auto ptype = CurrFrame().GetColumnType("REC_Particle_px");
+      if(ptype.find("double")!=std::string::npos) DefineMergedParticles<double>(merged);
+      else DefineMergedParticles<float>(merged);
+      
+      //create columns for particle masses, charges and known species
+      DefinePidColumns(merged);
+
+      for(const auto& item:_particleItems){
+	if(item=="vx"||item=="vy"||item=="vz") setBranchAlias("REC_Particle_"+item,Rec()+item); //RECFT has no vertex
+	else if(item=="status") setBranchAlias(merged+item,Rec()+item);
+	else{
+	  auto itype = CurrFrame().GetColumnType("REC_Particle_"+item);
+	  if(itype.find("double")!=std::string::npos) DefineMergedItem<double>(merged,item);
+	  else if(itype.find("float")!=std::string::npos) DefineMergedItem<float>(merged,item);
+	  else if(itype.find("short")!=std::string::npos) DefineMergedItem<short>(merged,item);
+	  else if(itype.find("int")!=std::string::npos) DefineMergedItem<int>(merged,item);
+	  else DefineMergedItem<Char_t>(merged,item); //byte items, e.g. charge
+	}
+      }
+      
+      reaction::util::CountParticles(this,Rec());
+    }
+    template<typename Tp>
+    void CLAS12Reaction::DefineMergedParticles(const string& merged){
+      auto arena = Arena();
+      auto mode = _ftMergeMode;
+      
+      auto info = merged+"info"+DoNotWriteTag();
+      ROOT::RDF::ColumnNames_t cols = {"REC_Particle_px","REC_Particle_py","REC_Particle_pz","REC_Particle_pid","REC_Particle_status",
+				       "RECFT_Particle_px","RECFT_Particle_py","RECFT_Particle_pz","RECFT_Particle_pid","RECFT_Particle_status"};
+      
+      DefineSlotEntry(info,[arena,mode](unsigned int slot,ULong64_t entry,
+				       const ROOT::RVec<Tp>& px,const ROOT::RVec<Tp>& py,const ROOT::RVec<Tp>& pz,const ROOT::RVecI& pid,const ROOT::RVec<short>& status,
+				       const ROOT::RVec<Tp>& ftpx,const ROOT::RVec<Tp>& ftpy,const ROOT::RVec<Tp>& ftpz,const ROOT::RVecI& ftpid,const ROOT::RVec<short>& ftstatus){
+	  merged_particles_t<Tp> result;
+	  result.n = px.size();
+	  result.px = arena->template Allocate<Tp>(slot,entry,result.n);
+	  result.py = arena->template Allocate<Tp>(slot,entry,result.n);
+	  result.pz = arena->template Allocate<Tp>(slot,entry,result.n);
+	  result.pid = arena->template Allocate<int>(slot,entry,result.n);
+	  result.status = arena->template Allocate<short>(slot,entry,result.n);
+	  result.ft = arena->template Allocate<short>(slot,entry,result.n);
+	  MergeFTParticles(mode,px,py,pz,pid,status,ftpx,ftpy,ftpz,ftpid,ftstatus,result);
+	  return result;
+	},cols);
+      
+      DefineColumn(merged+"px",[](const merged_particles_t<Tp>& m){return ROOT::RVec<Tp>(m.px,m.n);},{info});
+      DefineColumn(merged+"py",[](const merged_particles_t<Tp>& m){return ROOT::RVec<Tp>(m.py,m.n);},{info});
+      DefineColumn(merged+"pz",[](const merged_particles_t<Tp>& m){return ROOT::RVec<Tp>(m.pz,m.n);},{info});
+      DefineColumn(merged+"pid",[](const merged_particles_t<Tp>& m){return ROOT::RVecI(m.pid,m.n);},{info});
+      DefineColumn(merged+"status",[](const merged_particles_t<Tp>& m){return ROOT::RVec<short>(m.status,m.n);},{info});
+      DefineColumn(merged+"ft",[](const merged_particles_t<Tp>& m){return ROOT::RVec<short>(m.ft,m.n);},{info});
+      
+      for(const auto& comp:{"px","py","pz","pid","ft"}) setBranchAlias(merged+comp,Rec()+comp);
+    }
+    /**
+     * Item from the same bank as the merged row
+     */
+    template<typename T>
+    void CLAS12Reaction::DefineMergedItem(const string& merged,const string& item){
+      auto arena = Arena();
+      DefineSlotEntry(merged+item,[arena](unsigned int slot,ULong64_t entry,const ROOT::RVec<short>& ft,const ROOT::RVec<T>& vals,const ROOT::RVec<T>& ftvals){
+	  auto result = arena->template Adopt<T>(slot,entry,ft.size());
+	  GatherFTItem(ft.data(),ft.size(),vals,ftvals,result.data());
+	  return result;
+	},{merged+"ft","REC_Particle_"+item,"RECFT_Particle_"+item});
+      setBranchAlias(merged+item,Rec()+item);
+    }
+    /**
+     * Compiled Filter on pid and status at the start of the graph,
+     * so failing events never evaluate later columns and
+     * banks only used by later columns are not read for them.
+     */
+    void CLAS12Reaction::PreSelect(const std::vector<std::pair<int,int>>& pid_counts,size_t min_n,size_t max_n,const std::vector<int>& regions){
+      if(_dataTypes.empty()==false){
+	throw std::logic_error("CLAS12Reaction::PreSelect must be called before AliasColumns");
+      }
+      if(pid_counts.size()>preselection_t::MaxPids){
+	throw std::logic_error("CLAS12Reaction::PreSelect at most "+std::to_string(preselection_t::MaxPids)+" pids");
+      }
+      preselection_t sel;
+      for(const auto& pc:pid_counts){
+	sel.pids.push_back(pc.first);
+	sel.counts.push_back(pc.second);
+	min_n = std::max(min_n,static_cast<size_t>(pc.second));
+      }
+      sel.regions = ROOT::RVecI(regions.begin(),regions.end());
+      sel.min_n = min_n;
+      sel.max_n = max_n;
+
+      _preSelected = true;
+      if(_ftMerge){
+	//the rows AliasColumnsMerged will give
+	auto arena = Arena();
+	auto mode = _ftMergeMode;
+	setCurrFrame(CurrFrame().Filter([sel,arena,mode](const ROOT::RVecI& pid,const ROOT::RVec<short>& status,const ROOT::RVecI& ftpid,const ROOT::RVec<short>& ftstatus,
+							   unsigned int slot,ULong64_t entry){
+	      auto mpid = arena->template Adopt<int>(slot,entry,pid.size());
+	      auto mstatus = arena->template Adopt<short>(slot,entry,pid.size());
+	      MergeFTPidStatus(mode,pid,status,ftpid,ftstatus,mpid.data(),mstatus.data());
+	      return PassPreSelection(mpid,mstatus,sel);
+	    },{"REC_Particle_pid","REC_Particle_status","RECFT_Particle_pid","RECFT_Particle_status","rdfslot_","rdfentry_"},"preselect"));
+	return;
+      }
+      string pid_col = _isFTBased ? "RECFT_Particle_pid" : "REC_Particle_pid";
+      string status_col = _isFTBased ? "RECFT_Particle_status" : "REC_Particle_status";
+      setCurrFrame(CurrFrame().Filter([sel](const ROOT::RVecI& pid,const ROOT::RVec<short>& status){
+	    return PassPreSelection(pid,status,sel);
+	  },{pid_col,status_col},"preselect"));
+    }
     /**
      * Only alias MC::Lund columns
      */ 
     void CLAS12Reaction::AliasColumnsMC(Bool_t IsEnd){
       AddType(Truth());
+      _dataTypes.push_back(Truth());
 	
       setBranchAlias("MC_Lund_px",Truth()+"px");
       setBranchAlias("MC_Lund_py",Truth()+"py");
@@ -141,7 +492,91 @@ namespace rad{
       setBranchAlias("MC_Lund_pid",Truth()+"pid");
       setBranchAlias("MC_Lund_mass",Truth()+"m");
 	
-      Define(Truth()+"n",Form("rad::helpers::Count(MC_Lund_type,static_cast<short>(1))") );
+      //number of generated (type==1) particles, compiled rather than JIT'd
+      auto ttype = CurrFrame().GetColumnType("MC_Lund_type");
+      if(ttype.find("char")!=std::string::npos || ttype.find("Char_t")!=std::string::npos)
+	DefineColumn(Truth()+"n",[](const ROOT::RVec<char>& type){return CountEqual(type,static_cast<char>(1));},{"MC_Lund_type"});
+      else if(ttype.find("int")!=std::string::npos || ttype.find("Int_t")!=std::string::npos)
+	DefineColumn(Truth()+"n",[](const ROOT::RVecI& type){return CountEqual(type,1);},{"MC_Lund_type"});
+      else
+	DefineColumn(Truth()+"n",[](const ROOT::RVec<short>& type){return CountEqual(type,static_cast<short>(1));},{"MC_Lund_type"});
+    }
+    /**
+     * Masses, charges and a known species flag from the pid
+     * made in one pass of the pid table into arena memory.
+     * Aliased to rec_m, rec_pidcharge and rec_known
+     */
+    void CLAS12Reaction::DefinePidColumns(const string& bank){
+      auto arena = Arena();
+      
+      auto info = bank+"pidinfo"+DoNotWriteTag();
+      DefineSlotEntry(info,[arena](unsigned int slot,ULong64_t entry,const ROOT::RVecI& pid){
+	  pid_info_t result;
+	  result.n = pid.size();
+	  result.masses = arena->Allocate<double>(slot,entry,result.n);
+	  result.charges = arena->Allocate<short>(slot,entry,result.n);
+	  result.known = arena->Allocate<short>(slot,entry,result.n);
+	  FillPidInfo(pid,result.masses,result.charges,result.known);
+	  return result;
+	},{Rec()+"pid"});
+      DefineColumn(bank+"m",[](const pid_info_t& info){
+	  return ROOT::RVecD(info.masses,info.n);
+	},{info});
+      DefineColumn(bank+"pidcharge",[](const pid_info_t& info){
+	  return ROOT::RVec<short>(info.charges,info.n);
+	},{info});
+      DefineColumn(bank+"known",[](const pid_info_t& info){
+	  return ROOT::RVec<short>(info.known,info.n);
+	},{info});
+      
+      //need to alias for redefines
+      setBranchAlias(bank+"m",Rec()+"m");
+      setBranchAlias(bank+"pidcharge",Rec()+"pidcharge");
+      setBranchAlias(bank+"known",Rec()+"known");
+    }
+    /**
+     * Alias the optional particle items requested in ReadParticleItems
+     * vertex_bank is used for vx,vy,vz as RECFT::Particle has no vertex
+     */
+    void CLAS12Reaction::AliasParticleItems(const string& bank,const string& vertex_bank){
+      for(const auto& item:_particleItems){
+	if(item=="vx"||item=="vy"||item=="vz") setBranchAlias(vertex_bank+item,Rec()+item);
+	else setBranchAlias(bank+item,Rec()+item);
+      }
+    }
+    /**
+     * Alias RUN::config run and event numbers
+     * These give a unique event id which does not depend on
+     * the order events were processed, as needed with ROOT::EnableImplicitMT
+     */ 
+    void CLAS12Reaction::AliasRunEvent(){
+      setBranchAlias("RUN_config_run","run");
+      setBranchAlias("RUN_config_event","event");
+    }
+    /**
+     * Table lookups on the run number, no JIT
+     */
+    void CLAS12Reaction::LoadRunConditions(const string& csvfile){
+      _conditions = std::make_shared<RunConditions>(csvfile);
+      auto table = _conditions;
+      DefineColumn("beam_energy",[table](int run){return table->Get(run).beam_energy;},{"RUN_config_run"});
+      DefineColumn("torus",[table](int run){return table->Get(run).torus;},{"RUN_config_run"});
+      DefineColumn("solenoid",[table](int run){return table->Get(run).solenoid;},{"RUN_config_run"});
+    }
+    double CLAS12Reaction::FixBeamFromRunConditions(){
+      if(_conditions.get()==nullptr){
+	throw std::logic_error("CLAS12Reaction::FixBeamFromRunConditions call LoadRunConditions first");
+      }
+      auto groups = _conditions->GroupFilesByBeamEnergy(_files);
+      if(groups.size()!=1){
+	std::ostringstream message;
+	message<<"CLAS12Reaction::FixBeamFromRunConditions input files have "<<groups.size()<<" beam energies, process them separately";
+	for(const auto& group:groups) message<<"\n   "<<group.first<<" GeV : "<<group.second.size()<<" files";
+	throw std::runtime_error(message.str());
+      }
+      auto energy = groups.begin()->first;
+      FixBeamElectronMomentum(0,0,energy);
+      return energy;
     }
     /**
      * Alias ReconstructedParticles and MCParticle columns
@@ -166,6 +601,16 @@ namespace rad{
       _truthMatched = true;
 	
       if(IsEnd){
+	//make the permutation once per event, for all columns
+	auto ntype = CurrFrame().GetColumnType(Truth()+"n");
+	if(ntype=="int") DefineMatchPermutation<int>();
+	else if(ntype=="unsigned int") DefineMatchPermutation<unsigned int>();
+	else if(ntype=="short") DefineMatchPermutation<short>();
+	else if(ntype=="long") DefineMatchPermutation<long>();
+	else if(ntype=="Long64_t" || ntype=="long long") DefineMatchPermutation<Long64_t>();
+	else if(ntype=="ULong64_t" || ntype=="unsigned long long") DefineMatchPermutation<ULong64_t>();
+	else DefineMatchPermutation<unsigned long>();
+
 	reaction::util::RedefineFundamentalAliases(this);
 
       }
@@ -183,6 +628,7 @@ namespace rad{
 	reaction::util::ResolutionFraction(this,"pmag");
 	reaction::util::Resolution(this,"theta");
 	reaction::util::Resolution(this,"phi");
+	_optionalColumns.insert({"res_pmag","res_theta","res_phi"});
       }
     }
     /**
@@ -190,15 +636,170 @@ namespace rad{
      */
     void CLAS12Reaction::AddAdditionalComponents(){
       //and add some additional columns
-      DefineForAllTypes("phi", Form("rad::ThreeVectorPhi(components_p3)"));
-      DefineForAllTypes("theta", Form("rad::ThreeVectorTheta(components_p3)"));
-      DefineForAllTypes("pmag", Form("rad::ThreeVectorMag(components_p3)"));
-	 
-	 
+      //use compiled kernel for float or double momentum
+      for(const auto& type:_dataTypes){
+	auto ptype = CurrFrame().GetColumnType(type+"px");
+	if(ptype.find("double")!=std::string::npos) DefineSphericalComponents<double>(type);
+	else DefineSphericalComponents<float>(type);
+      }
+    }
+    /**
+     * Define phi, theta and pmag for one type (rec_ or tru_)
+     * all three are filled together by FillSpherical
+     */
+    template<typename T>
+    void CLAS12Reaction::DefineSphericalComponents(const string& type){
+      auto arena = Arena();
+      //flag per slot, set on the slot's first event and only read after,
+      //so sharing a cache line costs at most one invalidation per slot
+      auto calculated = std::make_shared<std::vector<char>>(CurrFrame().GetNSlots(),0);
+      _calculated[type] = calculated;
+      _optionalColumns.insert({type+"phi",type+"theta",type+"pmag"});
+      
+      auto sph = type+"spherical"+DoNotWriteTag();
+      DefineSlotEntry(sph,[arena,calculated](unsigned int slot,ULong64_t entry,const ROOT::RVec<T>& px,const ROOT::RVec<T>& py,const ROOT::RVec<T>& pz){
+	  if((*calculated)[slot]==0) (*calculated)[slot]=1;
+	  spherical_t<T> result;
+	  result.n = px.size();
+	  result.phi = arena->template Allocate<T>(slot,entry,result.n);
+	  result.theta = arena->template Allocate<T>(slot,entry,result.n);
+	  result.pmag = arena->template Allocate<T>(slot,entry,result.n);
+	  FillSpherical(px,py,pz,result.phi,result.theta,result.pmag);
+	  return result;
+	},{type+"px",type+"py",type+"pz"});
+      DefineColumn(type+"phi",[](const spherical_t<T>& sph){
+	  return ROOT::RVec<T>(sph.phi,sph.n);
+	},{sph});
+      DefineColumn(type+"theta",[](const spherical_t<T>& sph){
+	  return ROOT::RVec<T>(sph.theta,sph.n);
+	},{sph});
+      DefineColumn(type+"pmag",[](const spherical_t<T>& sph){
+	  return ROOT::RVec<T>(sph.pmag,sph.n);
+	},{sph});
+    }
+
+    /**
+     * Sort a tree into run and event order
+     * With multi-threading snapshot entries are written in whatever
+     * order the slots finish, this makes the output reproducible.
+     * The sorted entries are made in passes of at most max_bytes,
+     * each reads the input in entry order into a memory resident
+     * tree, then writes it out in sorted order. So every basket is
+     * read once per pass rather than once per entry.
+     */
+    inline void SortTreeByEvent(const string& filename,const string& treename="rad_tree",Long64_t max_bytes=500000000){
+      std::unique_ptr<TFile> file{TFile::Open(filename.data())};
+      if(file.get()==nullptr||file->IsZombie()) return;
+      auto tree = file->Get<TTree>(treename.data());
+      if(tree==nullptr) return;
+      if(tree->BuildIndex("run","event")<0){
+	std::cout<<"SortTreeByEvent no run and event branches in "<<filename<<", did you call AliasRunEvent ?"<<std::endl;
+	return;
+      }
+      auto index = dynamic_cast<TTreeIndex*>(tree->GetTreeIndex());
+      const Long64_t nentries = index->GetN();
+      const Long64_t* order = index->GetIndex();
+      const Long64_t entry_bytes = std::max(tree->GetTotBytes()/std::max(nentries,Long64_t(1)),Long64_t(1));
+      const Long64_t pass_entries = std::max(max_bytes/entry_bytes,Long64_t(1));
+
+      //shares the branch addresses of tree, kept in memory
+      std::unique_ptr<TTree> buffer{tree->CloneTree(0)};
+      buffer->SetDirectory(nullptr);
+      
+      auto sorted_name = filename + ".sorted";
+      TFile sorted_file(sorted_name.data(),"recreate");
+      auto sorted = tree->CloneTree(0);
+      sorted->SetTreeIndex(nullptr);
+
+      std::vector<std::pair<Long64_t,Long64_t>> reads; //input entry, sorted position in pass
+      std::vector<Long64_t> buffered; //buffer entry of each sorted position in pass
+      for(Long64_t first=0;first<nentries;first+=pass_entries){
+	const auto npass = std::min(pass_entries,nentries-first);
+	reads.clear();
+	for(Long64_t i=0;i<npass;++i) reads.push_back({order[first+i],i});
+	std::sort(reads.begin(),reads.end());
+	
+	buffer->Reset();
+	buffered.resize(npass);
+	for(size_t ib=0;ib<reads.size();++ib){
+	  tree->GetEntry(reads[ib].first);
+	  buffer->Fill();
+	  buffered[reads[ib].second] = ib;
+	}
+	for(Long64_t i=0;i<npass;++i){
+	  buffer->GetEntry(buffered[i]);
+	  sorted->Fill();
+	}
+      }
+      sorted->Write();
+      sorted_file.Close();
+      buffer.reset();
+      file->Close();
+      gSystem->Rename(sorted_name.data(),filename.data());
+    }
+    /**
+     * The columns Snapshot(filename) writes
+     */
+    ROOT::RDF::ColumnNames_t CLAS12Reaction::SnapshotColumns(){
+      ROOT::RDF::ColumnNames_t columns;
+      for(const auto& col:CurrFrame().GetDefinedColumnNames()){
+	if(col.find(DoNotWriteTag())!=string::npos) continue;
+	if(_keepAllColumns==false && IsOptionalColumn(col) && _keptColumns.count(col)==0) continue;
+	columns.push_back(col);
+      }
+      return columns;
+    }
+    /**
+     * Snapshot the defined columns, except DoNotWrite
+     * and optional columns which have not been kept
+     */
+    void CLAS12Reaction::Snapshot(const string& filename){
+      Snapshot(filename,SnapshotColumns());
+    }
+    void CLAS12Reaction::Snapshot(const string& filename,const ROOT::RDF::ColumnNames_t& columns){
+      _writtenColumns.insert(columns.begin(),columns.end());
+      CurrFrame().Snapshot("rad_tree",filename,columns);
+    }
+    void CLAS12Reaction::PrintPrunedColumns(std::ostream& os) const{
+      os<<"Optional columns, not written by Snapshot unless kept"<<std::endl;
+      for(const auto& col:_optionalColumns){
+	os<<"  "<<std::left<<std::setw(20)<<col<<(_writtenColumns.count(col) ? "written" : "pruned ");
+	bool tracked = false;
+	for(const auto& calc:_calculated){
+	  if(col.rfind(calc.first,0)!=0) continue;
+	  auto used = std::find(calc.second->begin(),calc.second->end(),1)!=calc.second->end();
+	  os<<(used ? "  calculated" : "  not calculated");
+	  tracked = true;
+	}
+	if(tracked==false) os<<"  calculation not tracked"; //e.g. res_ columns defined by rad
+	os<<std::endl;
+      }
+    }
+    /**
+     * Snapshot then sort entries in run and event order
+     * only need to sort if multi-threaded
+     */
+    void CLAS12Reaction::SnapshotOrdered(const string& filename){
+      Snapshot(filename);
+      if(ROOT::IsImplicitMTEnabled()) SortTreeByEvent(filename);
     }
 
+    /**
+     * Define the MC::Lund to REC::Particle permutation
+     * Tn is the type of the tru_n column
+     */
+    template<typename Tn>
+    void CLAS12Reaction::DefineMatchPermutation(){
+      auto arena = Arena();
+      DefineSlotEntry(MatchPermutation(),[arena](unsigned int slot,ULong64_t entry,const ROOT::RVec<short>& pindex,const ROOT::RVec<short>& mcindex,Tn ntruth){
+	  auto perm = arena->Adopt<short>(slot,entry,ntruth);
+	  FillMatchPermutation(perm.data(),perm.size(),pindex,mcindex);
+	  return perm;
+	},{Rec()+"match_id",Truth()+"match_id",Truth()+"n"});
+    }
     /**
      * Reorder REC::Particles to match MC::Lund
+     * Gathers with the shared permutation into arena memory
      */
     template<typename T> 
     void CLAS12Reaction::RedefineFundamental( const string& name ){
@@ -210,7 +811,12 @@ namespace rad{
       if(contains(name,Truth()+"match_id") ){return;}//don't reorder our order!
 	  
       if(contains(name,Rec()) ){
-	RedefineViaAlias(name,helpers::Reorder<T,short,short>,{name.data(),Rec()+"match_id",Truth()+"match_id",Truth()+"n"});
+	auto arena = Arena();
+	RedefineViaAlias(name,[arena](const ROOT::RVec<T>& vals,const ROOT::RVec<short>& perm,unsigned int slot,ULong64_t entry){
+	    auto result = arena->template Adopt<T>(slot,entry,perm.size());
+	    GatherPermutation(vals,perm,result.data());
+	    return result;
+	  },{name.data(),MatchPermutation(),"rdfslot_","rdfentry_"});
       }
 
     }
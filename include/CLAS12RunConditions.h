@@ -0,0 +1,126 @@
+#pragma once
+
+//!  Run conditions cache, standing in for RCDB
+
+/*!
+  Beam energy and torus/solenoid scales per run are read once from
+  a local csv dump,
+     run,beam_energy,torus,solenoid
+     5032,10.6041,-1,-1
+  into a dense table indexed by run - first run, so the per event
+  lookup is one array access. Runs not in the file give NaN.
+*/
+#include "hipo4/reader.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <limits>
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace rad{
+  namespace clas12 {
+    using std::string;
+
+    struct run_conditions_t{
+      double beam_energy = std::numeric_limits<double>::quiet_NaN();
+      float torus = std::numeric_limits<float>::quiet_NaN();
+      float solenoid = std::numeric_limits<float>::quiet_NaN();
+    };
+    
+    //! Class definition
+
+    class RunConditions {
+
+    public:
+
+      RunConditions(const string& csvfile);
+
+      const run_conditions_t& Get(int run) const {
+	const auto irun = static_cast<size_t>(static_cast<unsigned int>(run - _firstRun));
+	return irun<_table.size() ? _table[irun] : _unknown;
+      }
+      bool Has(int run) const {return Get(run).beam_energy==Get(run).beam_energy;}//not NaN
+      int FirstRun() const {return _firstRun;}
+      int LastRun() const {return _firstRun + static_cast<int>(_table.size()) - 1;}
+
+      /**
+       * Run number of the first event with RUN::config in a hipo file
+       */
+      static int FileRun(const string& hipofile);
+      /**
+       * Files grouped by the beam energy of their run,
+       * throws if a run is not in the table
+       */
+      std::map<double,std::vector<string>> GroupFilesByBeamEnergy(const std::vector<string>& files) const;
+      
+    private:
+
+      std::vector<run_conditions_t> _table;
+      run_conditions_t _unknown;
+      int _firstRun = 0;
+    };
+
+    /////////Class method implementations below
+    RunConditions::RunConditions(const string& csvfile){
+      std::ifstream in(csvfile);
+      if(!in){
+	throw std::runtime_error("RunConditions could not open "+csvfile);
+      }
+      std::map<int,run_conditions_t> runs;
+      string line;
+      while(std::getline(in,line)){
+	if(line.empty() || line[0]=='#' || std::isdigit(line[0])==0) continue; //header or comment
+	std::replace(line.begin(),line.end(),',',' ');
+	std::istringstream fields(line);
+	int run = 0;
+	run_conditions_t cond;
+	if(!(fields>>run>>cond.beam_energy>>cond.torus>>cond.solenoid)){
+	  std::cerr<<"RunConditions bad line in "<<csvfile<<" : "<<line<<std::endl;
+	  continue;
+	}
+	runs[run] = cond;
+      }
+      if(runs.empty()){
+	throw std::runtime_error("RunConditions no runs in "+csvfile);
+      }
+      _firstRun = runs.begin()->first;
+      _table.resize(runs.rbegin()->first - _firstRun + 1);
+      for(const auto& run:runs) _table[run.first-_firstRun] = run.second;
+      std::cout<<"RunConditions "<<runs.size()<<" runs from "<<csvfile<<std::endl;
+    }
+
+    int RunConditions::FileRun(const string& hipofile){
+      hipo::reader reader;
+      reader.open(hipofile.data());
+      hipo::dictionary factory;
+      reader.readDictionary(factory);
+      if(factory.hasSchema("RUN::config")==false) return 0;
+      hipo::bank config(factory.getSchema("RUN::config"));
+      hipo::event event;
+      while(reader.next()){
+	reader.read(event);
+	event.getStructure(config);
+	if(config.getRows()>0) return config.getInt("run",0);
+      }
+      return 0;
+    }
+
+    std::map<double,std::vector<string>> RunConditions::GroupFilesByBeamEnergy(const std::vector<string>& files) const{
+      std::map<double,std::vector<string>> groups;
+      for(const auto& file:files){
+	auto run = FileRun(file);
+	if(Has(run)==false){
+	  throw std::runtime_error("RunConditions no conditions for run "+std::to_string(run)+" of "+file);
+	}
+	groups[Get(run).beam_energy].push_back(file);
+      }
+      return groups;
+    }
+    
+  }//clas12
+}//rad
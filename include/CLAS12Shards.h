@@ -0,0 +1,366 @@
+#pragma once
+
+//!  Split a CLAS12 analysis into shards run by independent processes
+
+/*!
+  A ShardPlan divides the input files into work units (shards) of a
+  few files, or of an event range of one large file. The plan is saved
+  in a work directory so every worker and the merge see the same shards.
+  Each shard is processed by its own root process running an analysis
+  macro with signature macro(const string& plan,size_t shard,UInt_t nthreads),
+  which enables nthreads if more than 1, constructs its reaction from
+  the shard, writes its outputs to shard.Output(name) and calls
+  shard.Done() at the end.
+  ShardRunner launches the workers (locally, nworkers at a time),
+  retries failed shards and skips shards already done, so an
+  interrupted production is resumed by running it again.
+  Merge adds the histograms and concatenates the trees of all shards
+  in shard order, so the result does not depend on which shard
+  finished first.
+
+  Plan file :
+    RADSHARDS1 workdir
+    shard index first last
+    file name
+    ...
+*/
+#include "CLAS12EventIndex.h"
+#include "hipo4/reader.h"
+#include <TFileMerger.h>
+#include <TSystem.h>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <mutex>
+
+namespace rad{
+  namespace clas12 {
+    using std::string;
+
+    /**
+     * Quote a string for the shell, e.g. a path with spaces
+     */
+    inline string ShellQuote(const string& str){
+      string quoted = "'";
+      for(auto c:str){
+	if(c=='\'') quoted += "'\\''";
+	else quoted += c;
+      }
+      return quoted + "'";
+    }
+    /**
+     * Remove a directory and everything in it
+     */
+    inline void RemoveDirectory(const string& dir){
+      auto dirp = gSystem->OpenDirectory(dir.data());
+      if(dirp==nullptr) return;
+      while(auto entry = gSystem->GetDirEntry(dirp)){
+	string name = entry;
+	if(name=="." || name=="..") continue;
+	auto path = dir+"/"+name;
+	FileStat_t st;
+	if(gSystem->GetPathInfo(path.data(),st)==0 && R_ISDIR(st.fMode)) RemoveDirectory(path);
+	else gSystem->Unlink(path.data());
+      }
+      gSystem->FreeDirectory(dirp);
+      gSystem->Unlink(dir.data());
+    }
+    /**
+     * Number of events in a hipo file, from its record headers
+     */
+    inline Long64_t HipoEntries(const string& hipofile){
+      hipo::reader reader;
+      reader.open(hipofile.data());
+      return reader.getEntries();
+    }
+
+    /**
+     * One work unit, files of the shard and the range
+     * of their entries [first,last), last = -1 for all
+     */
+    struct shard_t{
+      size_t index = 0;
+      std::vector<string> files;
+      Long64_t first = 0;
+      Long64_t last = -1;
+      string workdir;
+
+      /**
+       * Directory and output files of this shard
+       */
+      string Directory() const{
+	std::ostringstream dir;
+	dir<<workdir<<"/shard_"<<std::setw(5)<<std::setfill('0')<<index;
+	return dir.str();
+      }
+      string Output(const string& name) const{
+	gSystem->mkdir(Directory().data(),kTRUE);
+	return Directory()+"/"+name;
+      }
+      /**
+       * Call when all outputs are written
+       */
+      void Done() const{std::ofstream(Output("done"))<<"done"<<std::endl;}
+      bool IsDone() const{return gSystem->AccessPathName((Directory()+"/done").data())==kFALSE;}
+
+      /**
+       * Selection for the CLAS12Reaction constructor,
+       * empty flags for all entries
+       */
+      index_selection_t Selection() const{
+	index_selection_t selection;
+	selection.files = files;
+	if(last>=0){
+	  selection.selected->resize(last,false);
+	  std::fill(selection.selected->begin()+first,selection.selected->end(),true);
+	}
+	return selection;
+      }
+    };
+
+    //! Class definition
+
+    class ShardPlan {
+
+    public:
+
+      ShardPlan() = default;
+      /**
+       * At most files_per_shard files in a shard.
+       * If events_per_shard > 0 files with more events are split into
+       * event ranges. Each range shard still reads its whole file,
+       * so prefer shards of whole files where there are enough files.
+       */
+      ShardPlan(const std::vector<string>& patterns,const string& workdir,size_t files_per_shard=10,Long64_t events_per_shard=0);
+
+      static ShardPlan Load(const string& planfile);
+      void Save(const string& planfile) const;
+      static string PlanName(const string& workdir){return workdir+"/shards.plan";}
+
+      size_t NShards() const {return _shards.size();}
+      const shard_t& Shard(size_t i) const {return _shards.at(i);}
+      const std::vector<shard_t>& Shards() const {return _shards;}
+      const string& WorkDir() const {return _workdir;}
+
+      bool operator==(const ShardPlan& other) const;
+
+    private:
+
+      void AddShard(const std::vector<string>& files,Long64_t first,Long64_t last){
+	_shards.push_back(shard_t{_shards.size(),files,first,last,_workdir});
+      }
+
+      string _workdir;
+      std::vector<shard_t> _shards;
+    };
+
+    //! Class definition
+
+    class ShardRunner {
+
+    public:
+
+      /**
+       * Save the plan in its work directory, or if a plan is already
+       * there check it is the same, so finished shards are reused.
+       * Workers load $CLAS12RAD/include/Load.C, so CLAS12RAD must be set.
+       */
+      ShardRunner(const ShardPlan& plan,const string& macro);
+
+      /**
+       * Run shards not yet done, nworkers processes at a time,
+       * each failed shard is retried up to max_retries times.
+       * nthreads is given to the macro for ROOT::EnableImplicitMT.
+       * Returns true if all shards are done.
+       */
+      bool Run(size_t nworkers=std::thread::hardware_concurrency(),size_t max_retries=2,UInt_t nthreads=1);
+      /**
+       * Merge output name of every shard into outfile, in shard order.
+       * Histograms are added and trees chained.
+       */
+      bool Merge(const string& name,const string& outfile) const;
+
+      std::vector<size_t> Pending() const;
+
+    private:
+
+      bool RunShard(const shard_t& shard,UInt_t nthreads) const;
+
+      ShardPlan _plan;
+      string _macro;
+      string _load;
+      bool _valid = true;
+    };
+
+    /////////Class method implementations below
+    ShardPlan::ShardPlan(const std::vector<string>& patterns,const string& workdir,size_t files_per_shard,Long64_t events_per_shard) : _workdir{workdir}{
+      std::vector<string> files;
+      for(const auto& pattern:patterns){
+	auto expanded = ExpandFileGlob(pattern);
+	files.insert(files.end(),expanded.begin(),expanded.end());
+      }
+      files_per_shard = std::max(files_per_shard,size_t(1));
+
+      std::vector<string> group;
+      size_t nsplit = 0;
+      for(const auto& file:files){
+	if(events_per_shard>0){
+	  Long64_t nevents = HipoEntries(file);
+	  if(nevents>events_per_shard){ //own shards for each event range
+	    for(Long64_t first=0;first<nevents;first+=events_per_shard){
+	      AddShard({file},first,std::min(first+events_per_shard,nevents));
+	    }
+	    ++nsplit;
+	    continue;
+	  }
+	}
+	group.push_back(file);
+	if(group.size()==files_per_shard){
+	  AddShard(group,0,-1);
+	  group.clear();
+	}
+      }
+      if(group.empty()==false) AddShard(group,0,-1);
+      std::cout<<"ShardPlan "<<files.size()<<" files in "<<_shards.size()<<" shards"<<std::endl;
+      if(nsplit){
+	std::cout<<"ShardPlan Warning "<<nsplit<<" files split into event ranges, each range shard reads its whole file"<<std::endl;
+      }
+    }
+
+    /**
+     * One entry per line, paths are the rest of their line
+     * so they may contain spaces
+     */
+    ShardPlan ShardPlan::Load(const string& planfile){
+      ShardPlan plan;
+      std::ifstream in(planfile);
+      const string magic = "RADSHARDS1 ";
+      string line;
+      if(!std::getline(in,line) || line.compare(0,magic.size(),magic)!=0){
+	std::cerr<<"ShardPlan::Load "<<planfile<<" is not a shard plan"<<std::endl;
+	return plan;
+      }
+      plan._workdir = line.substr(magic.size());
+      while(std::getline(in,line)){
+	if(line.compare(0,6,"shard ")==0){
+	  shard_t shard;
+	  std::istringstream fields(line.substr(6));
+	  fields>>shard.index>>shard.first>>shard.last;
+	  shard.workdir = plan._workdir;
+	  plan._shards.push_back(shard);
+	}
+	else if(line.compare(0,5,"file ")==0 && plan._shards.empty()==false){
+	  plan._shards.back().files.push_back(line.substr(5));
+	}
+      }
+      return plan;
+    }
+
+    void ShardPlan::Save(const string& planfile) const{
+      std::ofstream out(planfile);
+      out<<"RADSHARDS1 "<<_workdir<<"\n";
+      for(const auto& shard:_shards){
+	out<<"shard "<<shard.index<<" "<<shard.first<<" "<<shard.last<<"\n";
+	for(const auto& file:shard.files) out<<"file "<<file<<"\n";
+      }
+    }
+
+    bool ShardPlan::operator==(const ShardPlan& other) const{
+      if(_workdir!=other._workdir || _shards.size()!=other._shards.size()) return false;
+      for(size_t i=0;i<_shards.size();++i){
+	const auto& a = _shards[i];
+	const auto& b = other._shards[i];
+	if(a.files!=b.files || a.first!=b.first || a.last!=b.last) return false;
+      }
+      return true;
+    }
+
+    ShardRunner::ShardRunner(const ShardPlan& plan,const string& macro) : _plan{plan}, _macro{macro}{
+      auto clas12rad = gSystem->Getenv("CLAS12RAD");
+      if(clas12rad==nullptr){
+	throw std::logic_error("ShardRunner needs CLAS12RAD set, the workers load $CLAS12RAD/include/Load.C");
+      }
+      _load = string(clas12rad)+"/include/Load.C";
+      gSystem->mkdir(_plan.WorkDir().data(),kTRUE);
+      auto planfile = ShardPlan::PlanName(_plan.WorkDir());
+      if(gSystem->AccessPathName(planfile.data())==kFALSE){
+	if(ShardPlan::Load(planfile)==_plan) return; //resume
+	std::cerr<<"ShardRunner "<<planfile<<" is a different plan, use a new work directory"<<std::endl;
+	_valid = false;
+	return;
+      }
+      _plan.Save(planfile);
+    }
+
+    std::vector<size_t> ShardRunner::Pending() const{
+      std::vector<size_t> pending;
+      for(const auto& shard:_plan.Shards()) if(shard.IsDone()==false) pending.push_back(shard.index);
+      return pending;
+    }
+
+    bool ShardRunner::RunShard(const shard_t& shard,UInt_t nthreads) const{
+      //start from nothing, a failed attempt may have left partial outputs
+      RemoveDirectory(shard.Directory());
+      gSystem->mkdir(shard.Directory().data(),kTRUE);
+      auto call = _macro+"(\""+ShardPlan::PlanName(_plan.WorkDir())+"\","+std::to_string(shard.index)+","+std::to_string(nthreads)+")";
+      auto command = "root -l -b -q "+ShellQuote(_load)+" "+ShellQuote(call)+" > "+ShellQuote(shard.Directory()+"/log")+" 2>&1";
+      auto status = gSystem->Exec(command.data());
+      return status==0 && shard.IsDone();
+    }
+
+    bool ShardRunner::Run(size_t nworkers,size_t max_retries,UInt_t nthreads){
+      if(_valid==false) return false;
+      auto pending = Pending();
+      std::cout<<"ShardRunner "<<pending.size()<<" of "<<_plan.NShards()<<" shards to run with "<<nworkers<<" workers of "<<nthreads<<" threads"<<std::endl;
+
+      for(size_t attempt=0;attempt<=max_retries && pending.empty()==false;++attempt){
+	std::atomic<size_t> next{0};
+	std::mutex mutex;
+	std::vector<size_t> failed;
+	auto worker = [&](){
+	  for(size_t i=next++;i<pending.size();i=next++){
+	    const auto& shard = _plan.Shard(pending[i]);
+	    if(RunShard(shard,nthreads)) continue;
+	    std::lock_guard<std::mutex> lock(mutex);
+	    failed.push_back(shard.index);
+	    std::cerr<<"ShardRunner shard "<<shard.index<<" failed, see "<<shard.Directory()<<"/log"<<std::endl;
+	  }
+	};
+	std::vector<std::thread> workers;
+	for(size_t iw=0;iw<std::max(nworkers,size_t(1));++iw) workers.emplace_back(worker);
+	for(auto& w:workers) w.join();
+	std::sort(failed.begin(),failed.end());
+	pending = failed;
+	if(pending.empty()==false && attempt<max_retries) std::cout<<"ShardRunner retrying "<<pending.size()<<" shards"<<std::endl;
+      }
+      if(pending.empty()==false){
+	std::cerr<<"ShardRunner "<<pending.size()<<" shards failed, run again to retry only these"<<std::endl;
+	return false;
+      }
+      return true;
+    }
+
+    bool ShardRunner::Merge(const string& name,const string& outfile) const{
+      if(_valid==false) return false;
+      if(Pending().empty()==false){
+	std::cerr<<"ShardRunner::Merge "<<Pending().size()<<" shards are not done"<<std::endl;
+	return false;
+      }
+      TFileMerger merger(kFALSE);
+      merger.OutputFile(outfile.data(),"RECREATE");
+      for(const auto& shard:_plan.Shards()){
+	auto file = shard.Directory()+"/"+name;
+	if(gSystem->AccessPathName(file.data())) continue; //shard had no output, e.g. no events
+	merger.AddFile(file.data(),kFALSE);
+      }
+      return merger.Merge();
+    }
+
+  }
+}
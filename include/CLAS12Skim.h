@@ -0,0 +1,614 @@
+#pragma once
+
+//!  Compact streaming skim output, alternative to Snapshot
+
+/*!
+  Only the requested columns are written, and for per particle
+  arrays only the entries of the named particles, e.g. rec_pmag[pip].
+  Rows are collected in chunks; each column of a chunk is compressed
+  and written by a background thread while the event loop fills the
+  next chunk. The footer indexes the chunks so the file can be memory
+  mapped on read back with SkimReader and columns decompressed on demand.
+
+  A value missing in an event, e.g. the particle index is -1, is
+  stored as NaN in floating point columns and as the smallest value of
+  the stored integer (skim::MissingI32, skim::MissingI64) in integer
+  columns. SkimReader gives NaN for these when reading into a floating
+  point type and std::numeric_limits<T>::min() for an integer type.
+
+  File layout :
+    "RADSKIM1"
+    chunk 0 : column 0 bytes, column 1 bytes, ...
+    chunk 1 : ...
+    footer  : ncolumns, {name, type}, nchunks, {nrows, {offset, stored, raw}}
+    footer offset (8 bytes) "RADSKIM1"
+*/
+#include "CLAS12Reaction.h"
+#include "CLAS12EventArena.h"
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RVec.hxx>
+#include <RZip.h>
+#include <Compression.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <cmath>
+#include <type_traits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace rad{
+  namespace clas12 {
+    namespace skim {
+
+      constexpr char Magic[] = "RADSKIM1";
+      constexpr size_t MagicSize = 8;
+      constexpr int MaxZipBlock = 0xffffff;//R__zip limit
+      
+      enum class type_t : uint8_t { F32=0, F64=1, I32=2, I64=3 };
+      
+      inline size_t TypeSize(type_t type){
+	return (type==type_t::F32 || type==type_t::I32) ? 4 : 8;
+      }
+      
+      constexpr int32_t MissingI32 = std::numeric_limits<int32_t>::min();
+      constexpr int64_t MissingI64 = std::numeric_limits<int64_t>::min();
+
+      /**
+       * One value of a row, integers are kept as integers
+       * so 64 bit values do not lose precision
+       */
+      union value_t{
+	double f;
+	int64_t i;
+      };
+      inline void SetValue(value_t& v, double val, std::true_type){v.f = val;}
+      inline void SetValue(value_t& v, int64_t val, std::false_type){v.i = val;}
+      template<typename T>
+      void SetValue(value_t& v, T val){SetValue(v,val,std::is_floating_point<T>{});}
+      /**
+       * Missing value marker for the store type of T
+       */
+      template<typename T>
+      void SetMissing(value_t& v){
+	if(std::is_floating_point<T>::value) v.f = std::numeric_limits<double>::quiet_NaN();
+	else v.i = sizeof(T)>4 ? MissingI64 : MissingI32;
+      }
+      /**
+       * Stored values back to T, missing values to NaN or the
+       * smallest value of an integer T
+       */
+      template<typename T>
+      T FromStored(int64_t val, bool missing){
+	if(missing) return std::is_floating_point<T>::value ? std::numeric_limits<T>::quiet_NaN() : std::numeric_limits<T>::min();
+	return static_cast<T>(val);
+      }
+      template<typename T>
+      T FromStored(double val){
+	if(std::isnan(val) && std::is_floating_point<T>::value==false) return std::numeric_limits<T>::min();
+	return static_cast<T>(val);
+      }
+
+      struct column_t{
+	string name;
+	type_t type;
+      };
+      
+      struct chunk_t{
+	uint64_t nrows = 0;
+	std::vector<std::vector<char>> columns;
+      };
+      
+      struct block_t{
+	uint64_t offset = 0;
+	uint64_t stored = 0;
+	uint64_t raw = 0;
+      };
+
+      /**
+       * Compress src into tgt with ROOT's R__zip, in blocks of MaxZipBlock.
+       * Returns false if it does not compress, then src should be stored raw
+       */
+      inline bool Compress(const std::vector<char>& src, std::vector<char>& tgt, int level){
+	tgt.resize(src.size());
+	size_t in = 0, out = 0;
+	while(in<src.size()){
+	  int srcsize = std::min<size_t>(src.size()-in,MaxZipBlock);
+	  int tgtsize = tgt.size()-out;
+	  int irep = 0;
+	  R__zipMultipleAlgorithm(level,&srcsize,const_cast<char*>(src.data()+in),&tgtsize,tgt.data()+out,&irep,ROOT::RCompressionSetting::EAlgorithm::kLZ4);
+	  if(irep<=0) return false;
+	  in += srcsize;
+	  out += irep;
+	}
+	tgt.resize(out);
+	return out<src.size();
+      }
+      /**
+       * Inverse of Compress
+       */
+      inline bool Decompress(const char* src, size_t srcsize, char* tgt, size_t tgtsize){
+	size_t in = 0, out = 0;
+	while(in<srcsize && out<tgtsize){
+	  int blocksrc = 0, blocktgt = 0;
+	  if(R__unzip_header(&blocksrc,(unsigned char*)(src+in),&blocktgt)!=0) return false;
+	  int irep = 0;
+	  R__unzip(&blocksrc,(unsigned char*)(src+in),&blocktgt,(unsigned char*)(tgt+out),&irep);
+	  if(irep!=blocktgt) return false;
+	  in += blocksrc;
+	  out += blocktgt;
+	}
+	return out==tgtsize;
+      }
+      
+      //! Class definition
+      /**
+       * Writes chunks to file in a background thread.
+       * Double buffered : the event loop fills one chunk
+       * while the previous one is compressed and written.
+       */
+      class FileWriter {
+
+      public:
+	FileWriter(const string& filename, const std::vector<column_t>& columns, size_t chunk_rows, int level) :
+	  _columns{columns}, _chunkRows{chunk_rows}, _level{level} {
+	  _file = std::fopen(filename.data(),"wb");
+	  if(_file==nullptr){
+	    throw std::runtime_error("skim::FileWriter could not open "+filename);
+	  }
+	  Write(Magic,MagicSize);
+	  _offset = MagicSize;
+	  ResetChunk(_filling);
+	  _thread = std::thread([this]{WriteLoop();});
+	}
+	~FileWriter(){
+	  try{Close();}
+	  catch(const std::exception& e){std::cerr<<e.what()<<std::endl;}
+	}
+	
+	/**
+	 * Append nrows rows, values row major, ncolumns per row
+	 */
+	void Append(const value_t* values, size_t nrows){
+	  std::unique_lock<std::mutex> lock(_mutex);
+	  const auto ncols = _columns.size();
+	  for(size_t irow=0;irow<nrows;++irow){
+	    const value_t* row = values + irow*ncols;
+	    for(size_t icol=0;icol<ncols;++icol) Put(_filling.columns[icol],_columns[icol].type,row[icol]);
+	    if(++_filling.nrows==_chunkRows) SwapChunk(lock);
+	  }
+	  _nrows += nrows;
+	}
+	/**
+	 * Write the last chunk and the footer, returns number of rows.
+	 * Throws if any write failed, e.g. the disk is full.
+	 */
+	uint64_t Close(){
+	  if(_file==nullptr) return _nrows;
+	  {
+	    std::unique_lock<std::mutex> lock(_mutex);
+	    if(_filling.nrows) SwapChunk(lock);
+	    _done = true;
+	  }
+	  _cond.notify_all();
+	  _thread.join();
+	  WriteFooter();
+	  if(std::fclose(_file)!=0) _writeFailed = true;
+	  _file = nullptr;
+	  if(_writeFailed) throw std::runtime_error("skim::FileWriter failed writing the skim file");
+	  return _nrows;
+	}
+	
+      private:
+
+	static void Put(std::vector<char>& col, type_t type, value_t val){
+	  auto size = col.size();
+	  col.resize(size+TypeSize(type));
+	  auto ptr = col.data()+size;
+	  switch(type){
+	  case type_t::F32 : {float v = val.f; std::memcpy(ptr,&v,4); break;}
+	  case type_t::F64 : {std::memcpy(ptr,&val.f,8); break;}
+	  case type_t::I32 : {int32_t v = static_cast<int32_t>(val.i); std::memcpy(ptr,&v,4); break;}
+	  case type_t::I64 : {std::memcpy(ptr,&val.i,8); break;}
+	  }
+	}
+	void Write(const void* data, size_t size){
+	  if(std::fwrite(data,1,size,_file)!=size) _writeFailed = true;
+	}
+	void ResetChunk(chunk_t& chunk){
+	  chunk.nrows = 0;
+	  chunk.columns.resize(_columns.size());
+	  for(size_t icol=0;icol<_columns.size();++icol){
+	    chunk.columns[icol].clear();
+	    chunk.columns[icol].reserve(_chunkRows*TypeSize(_columns[icol].type));
+	  }
+	}
+	/**
+	 * Hand the filled chunk to the writer thread,
+	 * waiting if it is still busy with the previous one
+	 */
+	void SwapChunk(std::unique_lock<std::mutex>& lock){
+	  _cond.wait(lock,[this]{return _hasPending==false;});
+	  std::swap(_filling,_pending);
+	  _hasPending = true;
+	  ResetChunk(_filling);
+	  _cond.notify_all();
+	}
+	void WriteLoop(){
+	  std::vector<char> zipped;
+	  while(true){
+	    std::unique_lock<std::mutex> lock(_mutex);
+	    _cond.wait(lock,[this]{return _hasPending||_done;});
+	    if(_hasPending==false && _done) return;
+	    lock.unlock();
+	    
+	    std::vector<block_t> blocks;
+	    for(const auto& col:_pending.columns){
+	      block_t block;
+	      block.offset = _offset;
+	      block.raw = col.size();
+	      const auto& out = Compress(col,zipped,_level) ? zipped : col;
+	      block.stored = out.size();
+	      Write(out.data(),out.size());
+	      _offset += out.size();
+	      blocks.push_back(block);
+	    }
+	    _chunkRowsWritten.push_back(_pending.nrows);
+	    _chunkBlocks.push_back(blocks);
+	    
+	    lock.lock();
+	    _hasPending = false;
+	    _cond.notify_all();
+	  }
+	}
+	void WriteFooter(){
+	  auto footer = _offset;
+	  auto put64 = [this](uint64_t v){Write(&v,8);};
+	  auto put32 = [this](uint32_t v){Write(&v,4);};
+	  put32(_columns.size());
+	  for(const auto& col:_columns){
+	    put32(col.name.size());
+	    Write(col.name.data(),col.name.size());
+	    uint8_t type = static_cast<uint8_t>(col.type);
+	    Write(&type,1);
+	  }
+	  put32(_chunkBlocks.size());
+	  for(size_t ic=0;ic<_chunkBlocks.size();++ic){
+	    put64(_chunkRowsWritten[ic]);
+	    for(const auto& block:_chunkBlocks[ic]){
+	      put64(block.offset);
+	      put64(block.stored);
+	      put64(block.raw);
+	    }
+	  }
+	  put64(footer);
+	  Write(Magic,MagicSize);
+	}
+	
+	std::vector<column_t> _columns;
+	size_t _chunkRows = 0;
+	int _level = 4;
+	std::FILE* _file = nullptr;
+	uint64_t _offset = 0;
+	bool _writeFailed = false;
+	uint64_t _nrows = 0;
+	
+	chunk_t _filling;
+	chunk_t _pending;
+	bool _hasPending = false;
+	bool _done = false;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+	std::thread _thread;
+	
+	std::vector<uint64_t> _chunkRowsWritten;
+	std::vector<std::vector<block_t>> _chunkBlocks;
+      };
+
+      /**
+       * Values of one event, memory owned by the EventArena
+       */
+      struct row_t{
+	value_t* values = nullptr;
+      };
+
+      //! Class definition
+      /**
+       * RDataFrame action, rows are batched per slot
+       * so the writer lock is only taken once per batch
+       */
+      class Action : public ROOT::Detail::RDF::RActionImpl<Action> {
+
+      public:
+	using Result_t = ULong64_t;
+	
+	Action(std::shared_ptr<FileWriter> writer, unsigned int nslots, size_t ncolumns, size_t batch_rows = 256) :
+	  _writer{writer}, _batches(nslots), _ncolumns{ncolumns}, _batchRows{batch_rows}, _result{std::make_shared<Result_t>(0)} {
+	  for(auto& batch:_batches) batch.reserve(_batchRows*_ncolumns);
+	}
+	Action(Action&&) = default;
+	Action(const Action&) = delete;
+
+	std::shared_ptr<Result_t> GetResultPtr() const {return _result;}
+	void Initialize() {}
+	void InitTask(TTreeReader*, unsigned int) {}
+	void Exec(unsigned int slot, const row_t& row){
+	  auto& batch = _batches[slot];
+	  batch.insert(batch.end(),row.values,row.values+_ncolumns);
+	  if(batch.size()>=_batchRows*_ncolumns){
+	    _writer->Append(batch.data(),batch.size()/_ncolumns);
+	    batch.clear();
+	  }
+	}
+	void Finalize(){
+	  for(auto& batch:_batches){
+	    if(batch.empty()==false) _writer->Append(batch.data(),batch.size()/_ncolumns);
+	    batch.clear();
+	  }
+	  *_result = _writer->Close();
+	}
+	std::string GetActionName() const {return "RadSkim";}
+	
+      private:
+	std::shared_ptr<FileWriter> _writer;
+	std::vector<std::vector<value_t>> _batches;
+	size_t _ncolumns = 0;
+	size_t _batchRows = 256;
+	std::shared_ptr<Result_t> _result;
+      };
+
+      /**
+       * Call func with a type tag for the C++ type name of a column
+       * arrays (RVec<T>) give the element type, returns false if unknown
+       */
+      template<typename T> struct tag_t{ using type = T; };
+      
+      template<typename Func>
+      bool DispatchType(string type, Func&& func){
+	auto rvec = type.find("RVec<");
+	if(rvec!=std::string::npos) type = type.substr(rvec+5,type.rfind('>')-rvec-5);
+	if(type=="double"||type=="Double_t") func(tag_t<double>{});
+	else if(type=="float"||type=="Float_t") func(tag_t<float>{});
+	else if(type=="int"||type=="Int_t") func(tag_t<int>{});
+	else if(type=="short"||type=="Short_t") func(tag_t<short>{});
+	else if(type=="char"||type=="Char_t") func(tag_t<char>{});
+	else if(type=="bool"||type=="Bool_t") func(tag_t<bool>{});
+	else if(type=="unsigned int"||type=="UInt_t") func(tag_t<unsigned int>{});
+	else if(type=="unsigned long"||type=="size_t") func(tag_t<unsigned long>{});
+	else if(type=="long"||type=="Long_t") func(tag_t<long>{});
+	else if(type=="Long64_t"||type=="long long") func(tag_t<Long64_t>{});
+	else if(type=="ULong64_t"||type=="unsigned long long") func(tag_t<ULong64_t>{});
+	else return false;
+	return true;
+      }
+      template<typename T>
+      type_t StoreType(){
+	if(std::is_same<T,double>::value) return type_t::F64;
+	if(std::is_floating_point<T>::value) return type_t::F32;
+	if(sizeof(T)>4) return type_t::I64;
+	return type_t::I32;
+      }
+      
+    }//skim
+
+    //! Class definition
+    /**
+     * Configure the skim columns then Book it. Rows are
+     * written during the same event loop as histograms
+     * and Snapshot, i.e. Book is lazy.
+     *
+     *   rad::clas12::SkimWriter skim{rf,"eppippim.radskim"};
+     *   skim.AddParticleColumns({"scat_ele","pip"},{"rec_pmag","rec_theta"});
+     *   skim.AddColumns({"rec_W","tru_W"});
+     *   auto nrows = skim.Book();
+     */
+    class SkimWriter {
+
+    public:
+      SkimWriter(CLAS12Reaction& cr, const string& filename, size_t chunk_rows=65536, int compression_level=4) :
+	_cr{cr}, _filename{filename}, _chunkRows{chunk_rows}, _level{compression_level} {}
+      
+      /**
+       * Scalar columns, e.g. rec_W
+       */
+      void AddColumns(const std::vector<string>& cols){
+	for(const auto& col:cols) AddColumn(col,"");
+      }
+      /**
+       * Entries of per particle array columns for named particles
+       * written as column[particle], e.g. rec_pmag[pip]
+       */
+      void AddParticleColumns(const std::vector<string>& particles, const std::vector<string>& cols){
+	for(const auto& particle:particles)
+	  for(const auto& col:cols) AddColumn(col,particle);
+      }
+      
+      ROOT::RDF::RResultPtr<ULong64_t> Book();
+      
+    private:
+      
+      void AddColumn(const string& col, const string& particle);
+      string RowCol(size_t icol) {return "skim_row_"+std::to_string(icol)+_cr.DoNotWriteTag();}
+
+      CLAS12Reaction& _cr;
+      string _filename;
+      size_t _chunkRows = 65536;
+      int _level = 4;
+      std::vector<skim::column_t> _columns;
+      std::vector<std::pair<string,string>> _sources;//column, particle
+    };
+
+    /////////Class method implementations below
+    void SkimWriter::AddColumn(const string& col, const string& particle){
+      auto type = _cr.CurrFrame().GetColumnType(col);
+      skim::type_t store = skim::type_t::F64;
+      if(skim::DispatchType(type,[&store](auto tag){store = skim::StoreType<typename decltype(tag)::type>();})==false){
+	throw std::runtime_error("SkimWriter column "+col+" has unsupported type "+type);
+      }
+      _columns.push_back(skim::column_t{particle.empty() ? col : col+"["+particle+"]",store});
+      _sources.push_back({col,particle});
+    }
+    /**
+     * Chain of compiled Defines, each puts one value
+     * in the row, then the Action writes it
+     */
+    ROOT::RDF::RResultPtr<ULong64_t> SkimWriter::Book(){
+      auto arena = _cr.Arena();
+      const auto ncols = _columns.size();
+      _cr.DefineColumn(RowCol(0),[arena,ncols](unsigned int slot,ULong64_t entry){
+	  return skim::row_t{arena->Allocate<skim::value_t>(slot,entry,ncols)};
+	},{"rdfslot_","rdfentry_"});
+      
+      for(size_t icol=0;icol<ncols;++icol){
+	const auto& col = _sources[icol].first;
+	const auto& particle = _sources[icol].second;
+	auto type = _cr.CurrFrame().GetColumnType(col);
+	bool isArray = type.find("RVec<")!=std::string::npos;
+	auto prev = RowCol(icol);
+	auto next = RowCol(icol+1);
+	skim::DispatchType(type,[&](auto tag){
+	    using T = typename decltype(tag)::type;
+	    if(particle.empty()==false && isArray){
+	      _cr.DefineColumn(next,[icol](const skim::row_t& row,const ROOT::RVec<T>& vals,int index){
+		  if(index>=0 && index<static_cast<int>(vals.size())) skim::SetValue(row.values[icol],vals[index]);
+		  else skim::SetMissing<T>(row.values[icol]);
+		  return row;
+		},{prev,col,particle});
+	    }
+	    else{
+	      _cr.DefineColumn(next,[icol](const skim::row_t& row,const T& val){
+		  skim::SetValue(row.values[icol],val);
+		  return row;
+		},{prev,col});
+	    }
+	  });
+      }
+      
+      auto writer = std::make_shared<skim::FileWriter>(_filename,_columns,_chunkRows,_level);
+      auto df = _cr.CurrFrame();
+      return df.Book<skim::row_t>(skim::Action{writer,df.GetNSlots(),ncols},{RowCol(ncols)});
+    }
+
+    //! Class definition
+    /**
+     * Memory mapped reader for skim files
+     *   rad::clas12::SkimReader reader{"eppippim.radskim"};
+     *   auto pmag = reader.Column<float>("rec_pmag[pip]");
+     */
+    class SkimReader {
+
+    public:
+      SkimReader(const string& filename){
+	_fd = open(filename.data(),O_RDONLY);
+	struct stat st;
+	if(_fd<0 || fstat(_fd,&st)!=0){
+	  if(_fd>=0) close(_fd);
+	  throw std::runtime_error("SkimReader could not open "+filename);
+	}
+	_size = st.st_size;
+	_data = static_cast<const char*>(mmap(nullptr,_size,PROT_READ,MAP_PRIVATE,_fd,0));
+	if(_data==MAP_FAILED || _size<2*skim::MagicSize+8 || std::memcmp(_data,skim::Magic,skim::MagicSize)!=0){
+	  if(_data!=MAP_FAILED) munmap(const_cast<char*>(_data),_size);
+	  close(_fd);
+	  throw std::runtime_error("SkimReader "+filename+" is not a skim file");
+	}
+	ReadFooter();
+      }
+      ~SkimReader(){
+	if(_data!=nullptr && _data!=MAP_FAILED) munmap(const_cast<char*>(_data),_size);
+	if(_fd>=0) close(_fd);
+      }
+      SkimReader(const SkimReader&) = delete;
+      
+      const std::vector<skim::column_t>& Columns() const {return _columns;}
+      size_t NChunks() const {return _chunkRows.size();}
+      uint64_t NRows() const {uint64_t n=0; for(auto r:_chunkRows) n+=r; return n;}
+      
+      /**
+       * All values of a column converted to T,
+       * missing values are NaN or std::numeric_limits<T>::min()
+       */
+      template<typename T>
+      std::vector<T> Column(const string& name) const {
+	std::vector<T> result;
+	result.reserve(NRows());
+	auto icol = ColumnIndex(name);
+	std::vector<char> raw;
+	for(size_t ic=0;ic<NChunks();++ic){
+	  const auto& block = _blocks[ic][icol];
+	  const char* ptr = _data + block.offset;
+	  if(block.stored!=block.raw){
+	    raw.resize(block.raw);
+	    if(skim::Decompress(ptr,block.stored,raw.data(),block.raw)==false){
+	      throw std::runtime_error("SkimReader failed to decompress "+name+" chunk "+std::to_string(ic));
+	    }
+	    ptr = raw.data();
+	  }
+	  //uncompressed blocks are read straight from the mapped file
+	  Convert(ptr,_chunkRows[ic],_columns[icol].type,result);
+	}
+	return result;
+      }
+      
+    private:
+      
+      size_t ColumnIndex(const string& name) const {
+	for(size_t i=0;i<_columns.size();++i) if(_columns[i].name==name) return i;
+	throw std::runtime_error("SkimReader no column "+name);
+      }
+      template<typename T>
+      static void Convert(const char* ptr,uint64_t n,skim::type_t type,std::vector<T>& out){
+	for(uint64_t i=0;i<n;++i){
+	  switch(type){
+	  case skim::type_t::F32 : {float v; std::memcpy(&v,ptr+4*i,4); out.push_back(skim::FromStored<T>(double(v))); break;}
+	  case skim::type_t::F64 : {double v; std::memcpy(&v,ptr+8*i,8); out.push_back(skim::FromStored<T>(v)); break;}
+	  case skim::type_t::I32 : {int32_t v; std::memcpy(&v,ptr+4*i,4); out.push_back(skim::FromStored<T>(v,v==skim::MissingI32)); break;}
+	  case skim::type_t::I64 : {int64_t v; std::memcpy(&v,ptr+8*i,8); out.push_back(skim::FromStored<T>(v,v==skim::MissingI64)); break;}
+	  }
+	}
+      }
+      void ReadFooter(){
+	uint64_t footer = 0;
+	std::memcpy(&footer,_data+_size-skim::MagicSize-8,8);
+	const char* ptr = _data+footer;
+	auto get32 = [&ptr](){uint32_t v; std::memcpy(&v,ptr,4); ptr+=4; return v;};
+	auto get64 = [&ptr](){uint64_t v; std::memcpy(&v,ptr,8); ptr+=8; return v;};
+	auto ncols = get32();
+	for(uint32_t i=0;i<ncols;++i){
+	  auto len = get32();
+	  string name(ptr,len);
+	  ptr += len;
+	  auto type = static_cast<skim::type_t>(*ptr);
+	  ++ptr;
+	  _columns.push_back({name,type});
+	}
+	auto nchunks = get32();
+	for(uint32_t ic=0;ic<nchunks;++ic){
+	  _chunkRows.push_back(get64());
+	  std::vector<skim::block_t> blocks(ncols);
+	  for(auto& block:blocks){
+	    block.offset = get64();
+	    block.stored = get64();
+	    block.raw = get64();
+	  }
+	  _blocks.push_back(blocks);
+	}
+      }
+      
+      int _fd = -1;
+      size_t _size = 0;
+      const char* _data = nullptr;
+      std::vector<skim::column_t> _columns;
+      std::vector<uint64_t> _chunkRows;
+      std::vector<std::vector<skim::block_t>> _blocks;
+    };
+    
+  }//clas12
+}//rad
@@ -1,5 +1,11 @@
 #pragma once
 #include <ROOT/RVec.hxx>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <array>
+#include <limits>
+#include <cstdlib>
 
 
 namespace rad{
@@ -9,6 +15,8 @@ namespace rad{
      * missing elements will have index -1 and users will have to deal with this 
      * in subsequent functions
      * e.g. [1,3,2,0,0] , 6 -> [[3,4],[0],[2],[1],[],[]]
+     * Note this allocates a vector per particle, ReverseIndexFlat is used instead,
+     * this version is kept for comparison in benchmarks/BenchReverseIndex.C
      */
     //detector matrix [det][subdet][layer]
     using detector_matrix_t = ROOT::VecOps::RVec<ROOT::VecOps::RVec<short>>;
@@ -29,6 +37,105 @@ namespace rad{
       return result;
     }
     
+    /**
+     * Flat (CSR) version of the detector matrix.
+     * Detector rows for particle i are
+     * rows[offsets[i]] ... rows[offsets[i+1]-1], in bank order.
+     * Only 2 vectors per event, which for normal multiplicities
+     * fit in the RVec small buffer, so no heap allocation.
+     */
+    struct detector_index_t {
+      ROOT::RVec<short> offsets; //nparticles+1
+      ROOT::RVec<short> rows;
+
+      size_t size() const {return offsets.empty() ? 0 : offsets.size()-1;}
+      short begin(size_t i) const {return offsets[i];}
+      short end(size_t i) const {return offsets[i+1];}
+      bool empty(size_t i) const {return i>=size() || offsets[i]==offsets[i+1];}
+      short front(size_t i) const {return rows[offsets[i]];}
+    };
+    
+    /**
+     * Same as ReverseIndexN but filled with a counting sort into
+     * a detector_index_t
+     * e.g. [1,3,2,0,0] , 6 -> offsets [0,2,3,4,5,5,5] rows [3,4,0,2,1]
+     */
+    template<typename Tn>
+     detector_index_t ReverseIndexFlat(const ROOT::VecOps::RVec<short>& vec,Tn nentries){
+      detector_index_t result;
+      size_t nparts = nentries;
+      for(auto idx:vec){//protect against pindex beyond particle bank
+	if(idx>=0 && static_cast<size_t>(idx)>=nparts) nparts = idx+1;
+      }
+      if(nparts==0) return result;
+      //count hits per particle
+      result.offsets.assign(nparts+1,0);
+      for(auto idx:vec) if(idx>=0) ++result.offsets[idx+1];
+      for(size_t i=1;i<=nparts;++i) result.offsets[i]+=result.offsets[i-1];
+      //place rows, using offsets[idx] as the fill position of idx
+      //afterwards offsets[idx] is the end of idx, so shift back
+      result.rows.resize(result.offsets[nparts]);
+      short entry = 0;
+      for(auto idx:vec){
+	if(idx>=0) result.rows[ result.offsets[idx]++ ] = entry;
+	++entry;
+      }
+      for(size_t i=nparts;i>0;--i) result.offsets[i] = result.offsets[i-1];
+      result.offsets[0] = 0;
+      return result;
+    }
+    /**
+     * Equivalent of helpers::Rearrange for detector_index_t
+     * new particle entry i takes the rows of old entry order[i]
+     * order entries <0 or beyond the index give no rows
+     */
+    template<typename Tord>
+     detector_index_t RearrangeIndex(const detector_index_t& index,const ROOT::VecOps::RVec<Tord>& order){
+      detector_index_t result;
+      auto nold = index.size();
+      auto nparts = order.size();
+      result.offsets.resize(nparts+1);
+      result.offsets[0] = 0;
+      for(size_t i=0;i<nparts;++i){
+	auto old = order[i];
+	short nhits = (old>=0 && static_cast<size_t>(old)<nold) ? index.end(old)-index.begin(old) : 0;
+	result.offsets[i+1] = result.offsets[i] + nhits;
+      }
+      result.rows.resize(result.offsets[nparts]);
+      for(size_t i=0;i<nparts;++i){
+	auto old = order[i];
+	if(old<0 || static_cast<size_t>(old)>=nold) continue;
+	std::copy(index.rows.begin()+index.begin(old),index.rows.begin()+index.end(old),result.rows.begin()+result.offsets[i]);
+      }
+      return result;
+    }
+    
+    /**
+     * Permutation from MC::Lund order to REC::Particle row,
+     * perm[mcindex[i]] = pindex[i], -1 if the truth particle is not matched.
+     * Made once per event, then GatherPermutation reorders each rec column
+     * the same way as helpers::Reorder.
+     */
+    inline void FillMatchPermutation(short* perm, size_t n, const ROOT::RVec<short>& pindex, const ROOT::RVec<short>& mcindex){
+      std::fill(perm,perm+n,-1);
+      const auto nmatch = std::min(pindex.size(),mcindex.size());
+      for(size_t i=0;i<nmatch;++i){
+	if(mcindex[i]>=0 && static_cast<size_t>(mcindex[i])<n) perm[mcindex[i]] = pindex[i];
+      }
+    }
+    /**
+     * out[i] = vals[perm[i]], 0 if not matched
+     */
+    template<typename T>
+    void GatherPermutation(const ROOT::RVec<T>& vals, const ROOT::RVec<short>& perm, T* out){
+      const auto n = perm.size();
+      const auto nvals = static_cast<short>(vals.size());
+      for(size_t i=0;i<n;++i){
+	const auto row = perm[i];
+	out[i] = (row>=0 && row<nvals) ? vals[row] : T(0);
+      }
+    }
+    
     ///////////////////////////////////////////////////////
     constexpr double PdgToMass(int pdg){
 
@@ -64,16 +171,285 @@ namespace rad{
       
     }//PdgToMass
 
+    ///////////////////////////////////////////////////////
+    constexpr short PdgToCharge(int pdg){
+
+      switch ( pdg ) {
+      case 11 :
+	return -1;
+      case -11 :
+	return 1;
+      case 211 :
+	return 1;
+      case -211 :
+	return -1;
+      case 321 :
+	return 1;
+      case -321 :
+	return -1;
+      case 2212 :
+	return 1;
+      case -2212 :
+	return -1;
+      case 45: //CLAS12 deuteron
+	return 1;
+	
+      default :
+	return 0;
+      }
+      
+    }//PdgToCharge
+
+    ///////////////////////////////////////////////////////
+    /**
+     * Lookup table for the species in PdgToMass
+     * slot = (pdg+Offset)%Size has no collisions for these codes,
+     * so a lookup is one modulo and a compare, no branches,
+     * and loops over particles can be vectorised.
+     * Unknown codes get mass 0, charge 0 and known = 0.
+     */
+    namespace pidtable{
+      constexpr int Size = 18;
+      constexpr int Offset = 18*123; //pdg+Offset >= 0 for all codes in table
+      constexpr int Codes[] = {11,-11,211,-211,321,-321,2212,-2212,2112,22,45};
+
+      constexpr unsigned Slot(int pdg){return (static_cast<unsigned>(pdg)+static_cast<unsigned>(Offset))%Size;}
+      
+      struct table_t{
+	int pdg[Size];
+	double mass[Size];
+	short charge[Size];
+	char known[Size];
+      };
+      constexpr table_t Make(){
+	table_t table{};
+	for(auto code:Codes){
+	  auto slot = Slot(code);
+	  table.pdg[slot] = code;
+	  table.mass[slot] = PdgToMass(code);
+	  table.charge[slot] = PdgToCharge(code);
+	  table.known[slot] = 1;
+	}
+	return table;
+      }
+      constexpr table_t Table = Make();
+
+      inline bool Known(int pdg){
+	auto slot = Slot(pdg);
+	return (Table.pdg[slot]==pdg) & (Table.known[slot]==1);
+      }
+    }//pidtable
+
+    /**
+     * Fill masses, charges and known species flags in one pass
+     * output arrays must have at least pid.size() entries
+     */
+    inline void FillPidInfo(const ROOT::RVecI& pid, double* masses, short* charges, short* known){
+      const auto n = pid.size();
+      const auto& table = pidtable::Table;
+      for(size_t i=0;i<n;++i){
+	auto slot = pidtable::Slot(pid[i]);
+	bool ok = (table.pdg[slot]==pid[i]) & (table.known[slot]==1);
+	masses[i] = ok ? table.mass[slot] : 0.;
+	charges[i] = ok ? table.charge[slot] : 0;
+	known[i] = ok;
+      }
+    }
+    /**
+     * Arrays for the pid derived columns of one event,
+     * memory is owned by the EventArena
+     */
+    struct pid_info_t{
+      double* masses = nullptr;
+      short* charges = nullptr;
+      short* known = nullptr;
+      size_t n = 0;
+    };
+    
+    /**
+     * Number of entries equal to val, e.g. MC::Lund type==1
+     */
+    template<typename T>
+    int CountEqual(const ROOT::RVec<T>& vec, const T val){
+      int n = 0;
+      for(auto v:vec) n += (v==val);
+      return n;
+    }
+    
     ///////////////////////////////////////////////////////
     ROOT::RVecD AssignMasses( const ROOT::RVecI &pid){
       auto n = pid.size();
       ROOT::RVecD masses(n);
+      const auto& table = pidtable::Table;
       for(size_t i=0;i<n;++i){
-	masses[i] = PdgToMass(pid[i]);
+	auto slot = pidtable::Slot(pid[i]);
+	masses[i] = (table.pdg[slot]==pid[i]) ? table.mass[slot] : 0.;
       }
       return masses;
     }
 
+    ///////////////////////////////////////////////////////
+    /**
+     * Spherical momentum components phi, theta and magnitude
+     * of all particles in one pass over px,py,pz.
+     * Same definitions as ROOT::Math 3D vectors.
+     */
+    template<typename T>
+    void FillSpherical(const ROOT::RVec<T>& px, const ROOT::RVec<T>& py, const ROOT::RVec<T>& pz, T* phi, T* theta, T* pmag){
+      const auto n = px.size();
+      for(size_t i=0;i<n;++i){
+	const T x = px[i];
+	const T y = py[i];
+	const T z = pz[i];
+	const T rho2 = x*x + y*y;
+	const T rho = std::sqrt(rho2);
+	pmag[i] = std::sqrt(rho2 + z*z);
+	theta[i] = (rho==0 && z==0) ? T(0) : std::atan2(rho,z);
+	phi[i] = (x==0 && y==0) ? T(0) : std::atan2(y,x);
+      }
+    }
+    /**
+     * Arrays for FillSpherical of one event,
+     * memory is owned by the EventArena
+     */
+    template<typename T>
+    struct spherical_t{
+      T* phi = nullptr;
+      T* theta = nullptr;
+      T* pmag = nullptr;
+      size_t n = 0;
+    };
+
+    /**
+     * Pre-selection on the raw particle bank.
+     * Only rows with detector region abs(status)/1000 in regions
+     * are counted (1 FT, 2 FD, 4 CD), all rows if regions is empty.
+     * Pass if the number of counted rows is in [min_n,max_n] and
+     * there are at least counts[i] rows with pid pids[i].
+     */
+    struct preselection_t{
+      ROOT::RVecI pids;
+      ROOT::RVecI counts;
+      ROOT::RVecI regions;
+      size_t min_n = 0;
+      size_t max_n = std::numeric_limits<size_t>::max();
+      static constexpr size_t MaxPids = 16;
+    };
+    
+    template<typename Tpid, typename Tstatus>
+    bool PassPreSelection(const ROOT::RVec<Tpid>& pid, const ROOT::RVec<Tstatus>& status, const preselection_t& sel){
+      if(pid.size()<sel.min_n) return false; //cannot pass
+      const size_t npids = sel.pids.size();
+      std::array<int,preselection_t::MaxPids> found{};
+      size_t n = 0;
+      const size_t nrows = pid.size();
+      for(size_t i=0;i<nrows;++i){
+	if(sel.regions.empty()==false){
+	  const int region = std::abs(static_cast<int>(status[i]))/1000;
+	  if(std::find(sel.regions.begin(),sel.regions.end(),region)==sel.regions.end()) continue;
+	}
+	++n;
+	for(size_t ip=0;ip<npids;++ip) found[ip] += (pid[i]==sel.pids[ip]);
+      }
+      if(n<sel.min_n || n>sel.max_n) return false;
+      for(size_t ip=0;ip<npids;++ip) if(found[ip]<sel.counts[ip]) return false;
+      return true;
+    }
+
+    ///////////////////////////////////////////////////////
+    /**
+     * Merging RECFT::Particle (FT based start time) with REC::Particle.
+     * The banks have the same rows, so detector bank pindex stays valid.
+     * PerEvent : all rows from RECFT if it has an FT electron, else REC
+     * PerParticle : each row from RECFT if it has a pid there, else REC
+     */
+    enum class ft_merge_t { PerEvent, PerParticle };
+
+    template<typename Tp>
+    struct merged_particles_t{
+      Tp* px = nullptr;
+      Tp* py = nullptr;
+      Tp* pz = nullptr;
+      int* pid = nullptr;
+      short* status = nullptr;
+      short* ft = nullptr; //1 if row from RECFT
+      size_t n = 0;
+    };
+    
+    inline bool HasFTElectron(const ROOT::RVecI& ftpid, const ROOT::RVec<short>& ftstatus){
+      const auto n = ftpid.size();
+      for(size_t i=0;i<n;++i)
+	if(ftpid[i]==11 && std::abs(ftstatus[i])/1000==1) return true;
+      return false;
+    }
+    /**
+     * Is row i taken from RECFT, eventFT from HasFTElectron
+     */
+    inline bool UseFTRow(ft_merge_t mode, bool eventFT, int ftpid){
+      return mode==ft_merge_t::PerEvent ? eventFT : ftpid!=0;
+    }
+    /**
+     * One pass over both banks, out arrays have rec size
+     */
+    template<typename Tp>
+    void MergeFTParticles(ft_merge_t mode,
+			  const ROOT::RVec<Tp>& px, const ROOT::RVec<Tp>& py, const ROOT::RVec<Tp>& pz,
+			  const ROOT::RVecI& pid, const ROOT::RVec<short>& status,
+			  const ROOT::RVec<Tp>& ftpx, const ROOT::RVec<Tp>& ftpy, const ROOT::RVec<Tp>& ftpz,
+			  const ROOT::RVecI& ftpid, const ROOT::RVec<short>& ftstatus,
+			  merged_particles_t<Tp>& out){
+      const auto n = out.n;
+      const bool aligned = ftpid.size()==n;
+      const bool eventFT = aligned && mode==ft_merge_t::PerEvent && HasFTElectron(ftpid,ftstatus);
+      for(size_t i=0;i<n;++i){
+	const bool useFT = aligned && UseFTRow(mode,eventFT,ftpid[i]);
+	out.px[i] = useFT ? ftpx[i] : px[i];
+	out.py[i] = useFT ? ftpy[i] : py[i];
+	out.pz[i] = useFT ? ftpz[i] : pz[i];
+	out.pid[i] = useFT ? ftpid[i] : pid[i];
+	out.status[i] = useFT ? ftstatus[i] : status[i];
+	out.ft[i] = useFT;
+      }
+    }
+    /**
+     * Only the pid and status of MergeFTParticles, for PreSelect
+     */
+    inline void MergeFTPidStatus(ft_merge_t mode, const ROOT::RVecI& pid, const ROOT::RVec<short>& status,
+				 const ROOT::RVecI& ftpid, const ROOT::RVec<short>& ftstatus, int* outpid, short* outstatus){
+      const auto n = pid.size();
+      const bool aligned = ftpid.size()==n;
+      const bool eventFT = aligned && mode==ft_merge_t::PerEvent && HasFTElectron(ftpid,ftstatus);
+      for(size_t i=0;i<n;++i){
+	const bool useFT = aligned && UseFTRow(mode,eventFT,ftpid[i]);
+	outpid[i] = useFT ? ftpid[i] : pid[i];
+	outstatus[i] = useFT ? ftstatus[i] : status[i];
+      }
+    }
+    /**
+     * Take other items from the same bank as MergeFTParticles
+     */
+    template<typename T>
+    void GatherFTItem(const short* ft, size_t n, const ROOT::RVec<T>& vals, const ROOT::RVec<T>& ftvals, T* out){
+      for(size_t i=0;i<n;++i) out[i] = ft[i] ? ftvals[i] : vals[i];
+    }
+
+#ifdef CLAS12RAD_PRECOMPILED
+    //instantiated in CLAS12Precompiled.C, see Load.C
+    extern template detector_index_t ReverseIndexFlat<unsigned long>(const ROOT::RVec<short>&,unsigned long);
+    extern template detector_index_t RearrangeIndex<short>(const detector_index_t&,const ROOT::RVec<short>&);
+    extern template void GatherPermutation<float>(const ROOT::RVec<float>&,const ROOT::RVec<short>&,float*);
+    extern template void GatherPermutation<double>(const ROOT::RVec<double>&,const ROOT::RVec<short>&,double*);
+    extern template void GatherPermutation<int>(const ROOT::RVec<int>&,const ROOT::RVec<short>&,int*);
+    extern template void GatherPermutation<short>(const ROOT::RVec<short>&,const ROOT::RVec<short>&,short*);
+    extern template void FillSpherical<float>(const ROOT::RVec<float>&,const ROOT::RVec<float>&,const ROOT::RVec<float>&,float*,float*,float*);
+    extern template void FillSpherical<double>(const ROOT::RVec<double>&,const ROOT::RVec<double>&,const ROOT::RVec<double>&,double*,double*,double*);
+    extern template void MergeFTParticles<float>(ft_merge_t,const ROOT::RVec<float>&,const ROOT::RVec<float>&,const ROOT::RVec<float>&,const ROOT::RVecI&,const ROOT::RVec<short>&,
+						 const ROOT::RVec<float>&,const ROOT::RVec<float>&,const ROOT::RVec<float>&,const ROOT::RVecI&,const ROOT::RVec<short>&,merged_particles_t<float>&);
+    extern template void MergeFTParticles<double>(ft_merge_t,const ROOT::RVec<double>&,const ROOT::RVec<double>&,const ROOT::RVec<double>&,const ROOT::RVecI&,const ROOT::RVec<short>&,
+						  const ROOT::RVec<double>&,const ROOT::RVec<double>&,const ROOT::RVec<double>&,const ROOT::RVecI&,const ROOT::RVec<short>&,merged_particles_t<double>&);
+    extern template bool PassPreSelection<int,short>(const ROOT::RVec<int>&,const ROOT::RVec<short>&,const preselection_t&);
+    extern template int CountEqual<short>(const ROOT::RVec<short>&,const short);
+#endif
     
   }//clas12
 }//rad